@@ -0,0 +1,65 @@
+#ifndef _ADAPTIVE_GRAIN_H
+#define _ADAPTIVE_GRAIN_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+/*
+ * AdaptiveGrain: picks how many task ids a worker claims at once.
+ *
+ * Chunks follow guided self-scheduling: a claim never takes more than
+ * remaining / num_workers tasks, so chunks shrink as a launch drains and the
+ * tail stays balanced.  Below that cap, the chunk is sized from the measured
+ * cost of a task so that one claim carries roughly kTargetChunkNs of work:
+ * cheap tasks get claimed in large batches, expensive tasks one at a time.
+ *
+ * The cost estimate is an exponential moving average shared by all workers.
+ * Updates race benignly; a lost sample only slows down adaptation.
+ */
+class AdaptiveGrain {
+    public:
+        // Amount of work one claim should amortize its queue overhead over.
+        static const int kTargetChunkNs = 20000;
+
+        AdaptiveGrain() : _nsPerTask(0.f) {}
+
+        /*
+          Returns the number of tasks to claim when `remaining` tasks of a
+          launch are still unclaimed. A positive `grain_size` overrides the
+          adaptive choice.
+         */
+        int chunkSize(int remaining, int num_workers, int grain_size) const {
+            if (remaining <= 0) return 1;
+            if (grain_size > 0) return std::min(grain_size, remaining);
+
+            int fair_share = (remaining + num_workers - 1) / std::max(1, num_workers);
+            float ns = _nsPerTask.load(std::memory_order_relaxed);
+            int min_chunk = 1;
+            if (ns > 0.f) {
+                min_chunk = std::max(1.f, std::min(kTargetChunkNs / ns, (float)remaining));
+            }
+            return std::max(1, std::min(min_chunk, fair_share));
+        }
+
+        /*
+          Records that a chunk of `num_tasks` tasks took `ns` nanoseconds.
+         */
+        void record(int num_tasks, long ns) {
+            if (num_tasks <= 0) return;
+            float sample = (float)ns / num_tasks;
+            float old = _nsPerTask.load(std::memory_order_relaxed);
+            float next = (old == 0.f) ? sample : 0.75f * old + 0.25f * sample;
+            _nsPerTask.store(next, std::memory_order_relaxed);
+        }
+
+        static long nowNs() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+    private:
+        std::atomic<float> _nsPerTask;
+};
+
+#endif
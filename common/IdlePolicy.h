@@ -0,0 +1,124 @@
+#ifndef _IDLE_POLICY_H
+#define _IDLE_POLICY_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+/*
+ * IdleConfig: thresholds for IdlePolicy, in nanoseconds.
+ *
+ * A worker that runs out of work first spins with a pause instruction for
+ * up to spin_ns, then yields its core until spin_ns + yield_ns have passed,
+ * and only then parks. With `adaptive` set, the total budget shrinks when
+ * work typically arrives later than the budget could cover, so long idle
+ * phases cost almost no CPU, and grows back once gaps get short again.
+ *
+ * current() holds the process-wide configuration that thread pools pick up
+ * when they are constructed.
+ */
+struct IdleConfig {
+    long spin_ns;
+    long yield_ns;
+    bool adaptive;
+
+    IdleConfig() : spin_ns(20000), yield_ns(80000), adaptive(true) {}
+
+    static IdleConfig& current() {
+        static IdleConfig config;
+        return config;
+    }
+};
+
+/*
+ * IdlePolicy: the spin-then-yield-then-park strategy shared by the thread
+ * pools. Parking itself stays with the pool, since only the pool knows
+ * which condition variable and wakeup protocol guard its queues:
+ *
+ *     long idle_start = IdlePolicy::nowNs();
+ *     if (!_idle.spinWait([this] { return _isDone || hasWork(); })) {
+ *         ... park on the pool's condition variable ...
+ *     }
+ *     _idle.recordIdle(IdlePolicy::nowNs() - idle_start);
+ *
+ * The idle-time estimate is shared by all workers of a pool and updated
+ * with relaxed atomics; a lost sample only slows down adaptation.
+ */
+class IdlePolicy {
+    public:
+        // Shortest budget auto-tuning will pick: covers a quick re-check
+        // without a syscall.
+        static const long kMinBudgetNs = 2000;
+
+        IdlePolicy(const IdleConfig& config = IdleConfig::current())
+            : _config(config), _idleNs(0.f),
+              _budgetNs(config.spin_ns + config.yield_ns) {}
+
+        /*
+          Spins, then yields, until ready() returns true or the idle budget
+          runs out. Returns true if ready() became true, false if the
+          caller should park.
+         */
+        template <typename Pred>
+        bool spinWait(Pred ready) {
+            long budget = _budgetNs.load(std::memory_order_relaxed);
+            long spin = std::min(budget, _config.spin_ns);
+            long start = nowNs();
+            long elapsed = 0;
+            while (elapsed < budget) {
+                if (ready()) return true;
+                if (elapsed < spin) {
+                    for (int i = 0; i < 64; i++) cpuRelax();
+                } else {
+                    std::this_thread::yield();
+                }
+                elapsed = nowNs() - start;
+            }
+            return ready();
+        }
+
+        /*
+          Records that a worker was idle for `ns` nanoseconds before work
+          arrived, whether it spun or parked in the meantime.
+         */
+        void recordIdle(long ns) {
+            if (!_config.adaptive) return;
+            float old = _idleNs.load(std::memory_order_relaxed);
+            float next = (old == 0.f) ? (float)ns : 0.75f * old + 0.25f * ns;
+            _idleNs.store(next, std::memory_order_relaxed);
+
+            // spinning only pays off if work usually shows up within the
+            // budget; otherwise just re-check briefly and park
+            long max_budget = _config.spin_ns + _config.yield_ns;
+            long budget = kMinBudgetNs;
+            if (next <= max_budget) {
+                budget = std::max(kMinBudgetNs, std::min(max_budget, (long)(2 * next)));
+            }
+            _budgetNs.store(budget, std::memory_order_relaxed);
+        }
+
+        long budgetNs() const {
+            return _budgetNs.load(std::memory_order_relaxed);
+        }
+
+        static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+            asm volatile("yield");
+#endif
+        }
+
+        static long nowNs() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+    private:
+        IdleConfig _config;
+        std::atomic<float> _idleNs;
+        std::atomic<long> _budgetNs;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef _MPMC_QUEUE_H
+#define _MPMC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * MPMCQueue: bounded lock-free multi-producer/multi-consumer FIFO, after
+ * Dmitry Vyukov's bounded MPMC queue.
+ *
+ * Every cell carries a sequence number that says whose turn it is: a
+ * producer may fill cell (pos & mask) once its sequence equals pos, and a
+ * consumer may drain it once its sequence equals pos + 1. Producers and
+ * consumers therefore only contend on their own position counter (one
+ * CAS each), and never on each other.
+ *
+ * push() fails instead of blocking when the queue is full, and pop() fails
+ * when it is empty; callers decide how to back off. T must be copyable.
+ */
+template <typename T>
+class MPMCQueue {
+    public:
+        MPMCQueue(int log_capacity = 10) {
+            _mask = ((size_t)1 << log_capacity) - 1;
+            _buffer = new Cell[_mask + 1];
+            for (size_t i = 0; i <= _mask; i++) {
+                _buffer[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            _enqueuePos.store(0, std::memory_order_relaxed);
+            _dequeuePos.store(0, std::memory_order_relaxed);
+        }
+
+        ~MPMCQueue() {
+            delete[] _buffer;
+        }
+
+        /*
+          Appends an item. Returns false if the queue is full.
+         */
+        bool push(const T& item) {
+            Cell* cell;
+            size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+            while (true) {
+                cell = &_buffer[pos & _mask];
+                size_t seq = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                if (diff == 0) {
+                    if (_enqueuePos.compare_exchange_weak(pos, pos + 1,
+                            std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return false; // full
+                } else {
+                    pos = _enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+            cell->data = item;
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /*
+          Removes the oldest item. Returns false if the queue is empty.
+         */
+        bool pop(T* item) {
+            Cell* cell;
+            size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+            while (true) {
+                cell = &_buffer[pos & _mask];
+                size_t seq = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+                if (diff == 0) {
+                    if (_dequeuePos.compare_exchange_weak(pos, pos + 1,
+                            std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return false; // empty
+                } else {
+                    pos = _dequeuePos.load(std::memory_order_relaxed);
+                }
+            }
+            *item = cell->data;
+            cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+            return true;
+        }
+
+        /*
+          Approximate: may report an item whose producer has claimed a
+          cell but not yet published it.
+         */
+        bool empty() const {
+            size_t head = _dequeuePos.load();
+            size_t tail = _enqueuePos.load();
+            return tail <= head;
+        }
+
+        size_t capacity() const {
+            return _mask + 1;
+        }
+
+    private:
+        static const int kCacheLine = 64;
+
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        char _pad0[kCacheLine];
+        Cell* _buffer;
+        size_t _mask;
+        char _pad1[kCacheLine];
+        std::atomic<size_t> _enqueuePos;
+        char _pad2[kCacheLine];
+        std::atomic<size_t> _dequeuePos;
+        char _pad3[kCacheLine];
+
+        MPMCQueue(const MPMCQueue&);
+        void operator=(const MPMCQueue&);
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef _NUMA_ALLOC_H
+#define _NUMA_ALLOC_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+/*
+ * Allocation for first-touch NUMA placement.
+ *
+ * The kernel places a page on the node of the thread that first writes
+ * it. Memory that the main thread zeroes with a serial loop therefore all
+ * lands on the main thread's node, and every worker on another node reads
+ * it remotely. numaAlloc() returns page-aligned memory whose pages have
+ * not been touched yet, so the array can be initialized by the threads
+ * that will work on it (see firstTouchAlloc() and FirstTouchTask in
+ * tests/tests.h).
+ *
+ * On Linux the memory always comes straight from mmap, whatever the
+ * number of nodes; elsewhere it is an ordinary page-aligned allocation.
+ * Returns NULL if the allocation fails.
+ */
+template <typename T>
+T* numaAlloc(size_t count) {
+    size_t bytes = count * sizeof(T);
+#if defined(__linux__)
+    void* ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : (T*)ptr;
+#else
+    void* ptr = NULL;
+    if (posix_memalign(&ptr, 4096, bytes) != 0) return NULL;
+    return (T*)ptr;
+#endif
+}
+
+/*
+ * Frees memory from numaAlloc(); count must match the allocation.
+ */
+template <typename T>
+void numaFree(T* ptr, size_t count) {
+    if (ptr == NULL) return;
+#if defined(__linux__)
+    munmap(ptr, count * sizeof(T));
+#else
+    free(ptr);
+#endif
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef _PARKING_LOT_H
+#define _PARKING_LOT_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+/*
+ * ParkingLot: per-worker parking slots for idle thread pool workers.
+ *
+ * Every worker owns a slot with its own mutex and condition variable, so
+ * waking one worker never disturbs the others. Parked workers are kept on
+ * an idle stack; unpark(n) pops at most n of them, most recently parked
+ * first since their caches are the warmest, so a launch that can keep k
+ * threads busy wakes min(k, parked) workers instead of all of them.
+ *
+ * The protocol is that of an eventcount. A worker announces that it is
+ * about to park, re-checks for work, and only then blocks:
+ *
+ *     worker:  _parking.park(id, [this] { return _isDone || hasWork(); });
+ *     waker:   publish work; _parking.unpark(n);
+ *
+ * park() registers the worker before calling ready(), and unpark() issues
+ * a full fence after the caller published its work before it looks at the
+ * idle count. So either the worker sees the new work or the waker sees the
+ * worker, and a wakeup is never lost. The idle count lets unpark() return
+ * without taking any lock while nobody is parked.
+ */
+class ParkingLot {
+    public:
+        ParkingLot(int num_slots) : _slots(new Slot[num_slots]), _numParked(0) {
+            _idle.reserve(num_slots);
+        }
+
+        ~ParkingLot() {
+            delete[] _slots;
+        }
+
+        /*
+          Parks the calling worker in `slot` unless ready() returns true
+          once it is registered. Returns when another thread unparks it.
+         */
+        template <typename Pred>
+        void park(int slot, Pred ready) {
+            parkFor(slot, ready, -1);
+        }
+
+        /*
+          Same as park(), but gives up after timeout_ns nanoseconds
+          (never if negative). Returns false if it timed out; a worker
+          that a waker picked just as it timed out counts as woken, since
+          the waker relies on it.
+         */
+        template <typename Pred>
+        bool parkFor(int slot, Pred ready, long timeout_ns) {
+            Slot& s = _slots[slot];
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.notified = false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(_idleMutex);
+                s.parked = true;
+                _idle.push_back(slot);
+                _numParked.fetch_add(1);
+            }
+
+            if (ready()) {
+                // cancel, unless a waker already picked us; then we are
+                // simply the worker it woke
+                withdraw(slot);
+                return true;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(s.mutex);
+                if (timeout_ns < 0) {
+                    s.cv.wait(lock, [&s] { return s.notified; });
+                    return true;
+                }
+                if (s.cv.wait_for(lock, std::chrono::nanoseconds(timeout_ns),
+                                  [&s] { return s.notified; })) {
+                    return true;
+                }
+            }
+            return !withdraw(slot);
+        }
+
+        /*
+          Wakes up to `count` parked workers. Call after publishing the
+          work they should pick up. Returns the number of workers woken.
+         */
+        int unpark(int count) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (count <= 0 || _numParked.load() == 0) {
+                return 0;
+            }
+
+            std::lock_guard<std::mutex> lock(_idleMutex);
+            int woken = 0;
+            while (woken < count && !_idle.empty()) {
+                Slot& s = _slots[_idle.back()];
+                _idle.pop_back();
+                s.parked = false;
+                {
+                    std::lock_guard<std::mutex> slot_lock(s.mutex);
+                    s.notified = true;
+                }
+                s.cv.notify_one();
+                woken++;
+            }
+            _numParked.fetch_sub(woken);
+            return woken;
+        }
+
+        /*
+          Wakes every parked worker, e.g. at shutdown.
+         */
+        void unparkAll() {
+            unpark(INT_MAX);
+        }
+
+        int numParked() const {
+            return _numParked.load();
+        }
+
+    private:
+        /*
+          Takes a registered worker off the idle stack. Returns false if a
+          waker got to it first.
+         */
+        bool withdraw(int slot) {
+            Slot& s = _slots[slot];
+            std::lock_guard<std::mutex> lock(_idleMutex);
+            if (!s.parked) return false;
+            s.parked = false;
+            _idle.erase(std::find(_idle.begin(), _idle.end(), slot));
+            _numParked.fetch_sub(1);
+            return true;
+        }
+
+        struct Slot {
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool notified; // guarded by mutex
+            bool parked;   // on _idle; guarded by _idleMutex
+
+            Slot() : notified(false), parked(false) {}
+        };
+
+        Slot* _slots;
+        std::mutex _idleMutex;
+        std::vector<int> _idle; // parked slots, most recent last
+        std::atomic<int> _numParked;
+
+        ParkingLot(const ParkingLot&);
+        void operator=(const ParkingLot&);
+};
+
+#endif
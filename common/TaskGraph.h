@@ -0,0 +1,171 @@
+#ifndef _TASK_GRAPH_H
+#define _TASK_GRAPH_H
+
+#include <algorithm>
+#include <vector>
+#include "itasksys.h"
+
+/*
+ * TaskGraph: an immutable DAG of bulk launches, recorded once with a
+ * TaskGraphCapture and then submitted any number of times with
+ * ITaskSystem::replay(). Everything a submission would otherwise work out
+ * per launch, i.e. which launches depend on which, how many dependencies
+ * each one waits for and which ones can start right away, is computed
+ * once when the graph is built.
+ *
+ * Nodes are numbered in recording order, and a node only depends on
+ * nodes recorded before it. The runnable of a node can be swapped with
+ * bind() between replays, e.g. to point the same graph at new buffers.
+ */
+class TaskGraph {
+    public:
+        struct Node {
+            IRunnable* runnable;
+            int numTotalTasks;
+            LaunchOptions options;
+            std::vector<int> dependencies; // earlier nodes, no duplicates
+            std::vector<int> dependents;   // later nodes
+            long pathLength; // tasks on the longest chain from here on, own included
+        };
+
+        int size() const {
+            return (int)_nodes.size();
+        }
+
+        const Node& node(int index) const {
+            return _nodes[index];
+        }
+
+        // Nodes without dependencies, in recording order.
+        const std::vector<int>& roots() const {
+            return _roots;
+        }
+
+        /*
+          Replaces the runnable of a node. Must not be called while a
+          replay of the graph is running.
+         */
+        void bind(int index, IRunnable* runnable) {
+            _nodes[index].runnable = runnable;
+        }
+
+    private:
+        friend class TaskGraphCapture;
+
+        std::vector<Node> _nodes;
+        std::vector<int> _roots;
+
+        void compile() {
+            _roots.clear();
+            for (size_t i = 0; i < _nodes.size(); i++) {
+                _nodes[i].dependents.clear();
+            }
+            for (size_t i = 0; i < _nodes.size(); i++) {
+                Node& node = _nodes[i];
+                if (node.dependencies.empty()) {
+                    _roots.push_back(i);
+                }
+                for (size_t j = 0; j < node.dependencies.size(); j++) {
+                    _nodes[node.dependencies[j]].dependents.push_back(i);
+                }
+            }
+            // recording order is a topological order
+            for (int i = (int)_nodes.size() - 1; i >= 0; i--) {
+                Node& node = _nodes[i];
+                long longest = 0;
+                for (size_t j = 0; j < node.dependents.size(); j++) {
+                    longest = std::max(longest, _nodes[node.dependents[j]].pathLength);
+                }
+                node.pathLength = node.numTotalTasks + longest;
+            }
+        }
+};
+
+/*
+ * TaskGraphCapture: an ITaskSystem that records launches instead of
+ * running them, so that code written against ITaskSystem can build a
+ * TaskGraph unchanged:
+ *
+ *     TaskGraphCapture capture;
+ *     TaskID a = capture.runAsyncWithDeps(&task_a, n, {});
+ *     capture.runAsyncWithDeps(&task_b, n, {a});
+ *     TaskGraph graph = capture.graph();
+ *     for (...) { t->replay(graph); t->sync(); }
+ *
+ * The TaskIDs it returns are node indices. sync() and run() become
+ * barriers: every launch recorded after them depends on every launch
+ * recorded before. Runnables are only stored, never called, and must
+ * outlive the graph; the self-deleting adapters that launchAsync()
+ * creates can therefore not be recorded.
+ */
+class TaskGraphCapture: public ITaskSystem {
+    public:
+        TaskGraphCapture() : ITaskSystem(1) {}
+
+        const char* name() {
+            return "Graph Capture";
+        }
+
+        void run(IRunnable* runnable, int num_total_tasks) {
+            runAsyncWithDeps(runnable, num_total_tasks, std::vector<TaskID>());
+            sync();
+        }
+
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps) {
+            return runAsyncWithOptions(runnable, num_total_tasks, deps, LaunchOptions());
+        }
+
+        TaskID runAsyncWithOptions(IRunnable* runnable, int num_total_tasks,
+                                   const std::vector<TaskID>& deps,
+                                   const LaunchOptions& options) {
+            TaskGraph::Node node;
+            node.runnable = runnable;
+            node.numTotalTasks = num_total_tasks;
+            node.options = options;
+            node.pathLength = 0;
+            node.dependencies = _barrier;
+            for (size_t i = 0; i < deps.size(); i++) {
+                if (deps[i] >= 0 && deps[i] < (TaskID)_graph._nodes.size()) {
+                    node.dependencies.push_back(deps[i]);
+                }
+            }
+            std::sort(node.dependencies.begin(), node.dependencies.end());
+            node.dependencies.erase(std::unique(node.dependencies.begin(), node.dependencies.end()),
+                                    node.dependencies.end());
+            _graph._nodes.push_back(node);
+            return (TaskID)_graph._nodes.size() - 1;
+        }
+
+        /*
+          Depending on the current sinks is enough to depend on
+          everything recorded so far.
+         */
+        void sync() {
+            std::vector<bool> has_dependents(_graph._nodes.size(), false);
+            for (size_t i = 0; i < _graph._nodes.size(); i++) {
+                const std::vector<int>& deps = _graph._nodes[i].dependencies;
+                for (size_t j = 0; j < deps.size(); j++) {
+                    has_dependents[deps[j]] = true;
+                }
+            }
+            _barrier.clear();
+            for (size_t i = 0; i < _graph._nodes.size(); i++) {
+                if (!has_dependents[i]) _barrier.push_back(i);
+            }
+        }
+
+        /*
+          Returns the graph recorded so far.
+         */
+        TaskGraph graph() {
+            _graph.compile();
+            return _graph;
+        }
+
+    private:
+        TaskGraph _graph;
+        std::vector<int> _barrier; // sinks as of the last sync()
+};
+
+#endif
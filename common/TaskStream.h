@@ -0,0 +1,146 @@
+#ifndef _TASK_STREAM_H
+#define _TASK_STREAM_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "itasksys.h"
+
+/*
+ * TaskStream: an independent submission queue on top of a shared
+ * ITaskSystem. Launches submitted to a stream run on the system's workers
+ * like any other, but the stream's sync() only waits for the launches
+ * submitted to that stream, so several pipelines can share one pool
+ * without waiting on each other's work:
+ *
+ *     TaskStream requests_a(t), requests_b(t);
+ *     requests_a.runAsyncWithDeps(&task, n, {});
+ *     requests_b.runAsyncWithDeps(&other_task, m, {});
+ *     requests_a.sync(); // does not wait for other_task
+ *
+ * A stream is an ITaskSystem itself, so code written against ITaskSystem
+ * runs on it unchanged. Its TaskIDs are those of the underlying system
+ * and can be used as dependencies across streams, and the system's
+ * workers count as the stream's, so parallelReduce() keeps their partials
+ * apart. Pools and the scheduling policy are the system's as well. The
+ * isolation is only as good as the system's wait(): engines that fall
+ * back to the default one wait for everything. A stream may only be used
+ * by one thread at a time.
+ */
+class TaskStream: public ITaskSystem {
+    public:
+        explicit TaskStream(ITaskSystem* system)
+            : ITaskSystem(1), _system(system), _callbacksLeft(0) {}
+
+        // waits for the stream's callbacks, which still refer to it
+        ~TaskStream() {
+            waitCallbacks();
+        }
+
+        const char* name() {
+            return "Stream";
+        }
+
+        void run(IRunnable* runnable, int num_total_tasks) {
+            runWithOptions(runnable, num_total_tasks, LaunchOptions());
+        }
+
+        void runWithOptions(IRunnable* runnable, int num_total_tasks,
+                            const LaunchOptions& options) {
+            _system->wait(_system->runAsyncWithOptions(runnable, num_total_tasks,
+                                                       std::vector<TaskID>(), options));
+        }
+
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps) {
+            return runAsyncWithOptions(runnable, num_total_tasks, deps, LaunchOptions());
+        }
+
+        TaskID runAsyncWithOptions(IRunnable* runnable, int num_total_tasks,
+                                   const std::vector<TaskID>& deps,
+                                   const LaunchOptions& options) {
+            TaskID id = _system->runAsyncWithOptions(runnable, num_total_tasks, deps, options);
+            _pending.push_back(id);
+            return id;
+        }
+
+        /*
+          Waits for the launches submitted to this stream since its last
+          sync() and for the callbacks registered through it with
+          onComplete(), and for nothing else.
+         */
+        void sync() {
+            std::vector<TaskID> pending;
+            pending.swap(_pending);
+            _system->waitAll(pending);
+            waitCallbacks();
+        }
+
+        void wait(TaskID id) {
+            _system->wait(id);
+        }
+
+        TaskID waitAny(const std::vector<TaskID>& ids) {
+            return _system->waitAny(ids);
+        }
+
+        bool isDone(TaskID id) {
+            return _system->isDone(id);
+        }
+
+        bool cancel(TaskID id) {
+            return _system->cancel(id);
+        }
+
+        void onComplete(TaskID id, const std::function<void()>& fn) {
+            {
+                std::lock_guard<std::mutex> lock(_callbackMutex);
+                _callbacksLeft++;
+            }
+            _system->onComplete(id, [this, fn] {
+                fn();
+                std::lock_guard<std::mutex> lock(_callbackMutex);
+                if (--_callbacksLeft == 0) {
+                    _callbackCv.notify_all();
+                }
+            });
+        }
+
+        bool setSchedulingPolicy(SchedulingPolicy policy) {
+            return _system->setSchedulingPolicy(policy);
+        }
+
+        long deadlineMisses() {
+            return _system->deadlineMisses();
+        }
+
+        int addPool(const char* name, int num_threads) {
+            return _system->addPool(name, num_threads);
+        }
+
+        int findPool(const char* name) {
+            return _system->findPool(name);
+        }
+
+        int numWorkers() {
+            return _system->numWorkers();
+        }
+
+        int workerIndex() const {
+            return _system->workerIndex();
+        }
+
+    private:
+        void waitCallbacks() {
+            std::unique_lock<std::mutex> lock(_callbackMutex);
+            _callbackCv.wait(lock, [this] { return _callbacksLeft == 0; });
+        }
+
+        ITaskSystem* _system;
+        std::vector<TaskID> _pending; // submitted since the last sync()
+        std::mutex _callbackMutex;
+        std::condition_variable _callbackCv;
+        int _callbacksLeft; // registered with onComplete() and not yet run
+};
+
+#endif
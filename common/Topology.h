@@ -0,0 +1,255 @@
+#ifndef _TOPOLOGY_H
+#define _TOPOLOGY_H
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+ * Where a thread pool pins its workers.
+ *
+ *   PLACEMENT_NONE     leave scheduling to the OS (the default)
+ *   PLACEMENT_COMPACT  fill one package before the next, SMT siblings
+ *                      next to each other
+ *   PLACEMENT_SCATTER  round-robin over packages, then over their cores;
+ *                      SMT siblings are only used once every core has a
+ *                      worker
+ *   PLACEMENT_CORES    one worker per physical core, package by package;
+ *                      SMT siblings are only used once every core has a
+ *                      worker
+ */
+enum PlacementPolicy {
+    PLACEMENT_NONE,
+    PLACEMENT_COMPACT,
+    PLACEMENT_SCATTER,
+    PLACEMENT_CORES,
+};
+
+/*
+ * Topology: the machine's logical CPUs as read from /sys/devices/system/cpu
+ * and their NUMA nodes from /sys/devices/system/node, read once per
+ * process. When sysfs is not available every logical CPU is treated as its
+ * own core on a single package and a single node.
+ */
+class Topology {
+    public:
+        struct Cpu {
+            int id;      // logical CPU number, as used for affinity
+            int package; // physical_package_id
+            int core;    // core_id, unique within the package
+            int smt;     // rank among the SMT siblings of its core
+            int node;    // NUMA node, numbered densely from 0
+        };
+
+        static const Topology& get() {
+            static Topology topology;
+            return topology;
+        }
+
+        const std::vector<Cpu>& cpus() const {
+            return _cpus;
+        }
+
+        int numNodes() const {
+            return _numNodes;
+        }
+
+        /*
+          Returns the NUMA node of a logical CPU, or 0 if it is unknown.
+         */
+        int nodeOf(int cpu) const {
+            if (cpu < 0 || cpu >= (int)_nodeOfCpu.size()) return 0;
+            return _nodeOfCpu[cpu];
+        }
+
+        /*
+          Returns the NUMA node the calling thread is running on right now.
+         */
+        int currentNode() const {
+            if (_numNodes == 1) return 0;
+#if defined(__linux__)
+            return nodeOf(sched_getcpu());
+#else
+            return 0;
+#endif
+        }
+
+        /*
+          Returns the logical CPU for each of num_threads workers under
+          `policy`, or -1 for workers that should not be pinned. Workers
+          wrap around when there are more of them than CPUs.
+         */
+        std::vector<int> placement(PlacementPolicy policy, int num_threads) const {
+            std::vector<int> result(num_threads, -1);
+            if (policy == PLACEMENT_NONE || _cpus.empty()) {
+                return result;
+            }
+
+            std::vector<Cpu> order(_cpus);
+            if (policy == PLACEMENT_COMPACT) {
+                std::sort(order.begin(), order.end(), compactOrder);
+            } else if (policy == PLACEMENT_SCATTER) {
+                // rank cores within their package, then interleave packages
+                std::sort(order.begin(), order.end(), compactOrder);
+                std::vector<std::pair<long, int> > keys;
+                int core_rank = 0;
+                for (size_t i = 0; i < order.size(); i++) {
+                    if (i > 0 && order[i].package != order[i - 1].package) {
+                        core_rank = 0;
+                    } else if (i > 0 && order[i].core != order[i - 1].core) {
+                        core_rank++;
+                    }
+                    long key = ((long)order[i].smt << 40) | ((long)core_rank << 20) |
+                        order[i].package;
+                    keys.push_back(std::make_pair(key, (int)i));
+                }
+                std::sort(keys.begin(), keys.end());
+                std::vector<Cpu> sorted;
+                for (size_t i = 0; i < keys.size(); i++) {
+                    sorted.push_back(order[keys[i].second]);
+                }
+                order.swap(sorted);
+            } else {
+                std::sort(order.begin(), order.end(), coresOrder);
+            }
+
+            for (int i = 0; i < num_threads; i++) {
+                result[i] = order[i % order.size()].id;
+            }
+            return result;
+        }
+
+        /*
+          Pins a thread to a logical CPU. Returns false if pinning failed or
+          is not supported on this platform; cpu < 0 is a no-op.
+         */
+        static bool pin(std::thread& thread, int cpu) {
+            if (cpu < 0) return true;
+#if defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+            return false;
+#endif
+        }
+
+        /*
+          Pins a pool's worker threads according to `policy`.
+         */
+        static void pinThreads(std::thread* threads, int num_threads, PlacementPolicy policy) {
+            if (policy == PLACEMENT_NONE) return;
+            std::vector<int> cpus = get().placement(policy, num_threads);
+            for (int i = 0; i < num_threads; i++) {
+                pin(threads[i], cpus[i]);
+            }
+        }
+
+        static bool parsePolicy(const char* name, PlacementPolicy* policy) {
+            static const char* names[] = {"none", "compact", "scatter", "cores"};
+            for (int i = 0; i < 4; i++) {
+                if (strcmp(name, names[i]) == 0) {
+                    *policy = (PlacementPolicy)i;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        std::vector<Cpu> _cpus;
+        std::vector<int> _nodeOfCpu;
+        int _numNodes;
+
+        Topology() {
+            // node ids can be sparse; number them densely in sysfs order
+            int max_cpu = 0;
+            std::vector<int> nodes = readList("/sys/devices/system/node/online");
+            std::vector<std::vector<int> > node_cpus;
+            for (size_t i = 0; i < nodes.size(); i++) {
+                node_cpus.push_back(readList("/sys/devices/system/node/node" +
+                                             std::to_string(nodes[i]) + "/cpulist"));
+                for (size_t j = 0; j < node_cpus[i].size(); j++) {
+                    max_cpu = std::max(max_cpu, node_cpus[i][j]);
+                }
+            }
+            _numNodes = std::max(1, (int)nodes.size());
+            _nodeOfCpu.assign(max_cpu + 1, 0);
+            for (size_t i = 0; i < node_cpus.size(); i++) {
+                for (size_t j = 0; j < node_cpus[i].size(); j++) {
+                    _nodeOfCpu[node_cpus[i][j]] = i;
+                }
+            }
+
+            std::vector<int> online = readList("/sys/devices/system/cpu/online");
+            if (online.empty()) {
+                int n = std::max(1u, std::thread::hardware_concurrency());
+                for (int i = 0; i < n; i++) online.push_back(i);
+            }
+            for (size_t i = 0; i < online.size(); i++) {
+                Cpu cpu;
+                cpu.id = online[i];
+                std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu.id) + "/topology/";
+                cpu.package = readInt(dir + "physical_package_id", 0);
+                cpu.core = readInt(dir + "core_id", cpu.id);
+                // siblings are listed in ascending order; our rank is our index
+                std::vector<int> siblings = readList(dir + "thread_siblings_list");
+                cpu.smt = 0;
+                for (size_t j = 0; j < siblings.size() && siblings[j] < cpu.id; j++) {
+                    cpu.smt++;
+                }
+                cpu.node = nodeOf(cpu.id);
+                _cpus.push_back(cpu);
+            }
+        }
+
+        static bool compactOrder(const Cpu& a, const Cpu& b) {
+            if (a.package != b.package) return a.package < b.package;
+            if (a.core != b.core) return a.core < b.core;
+            return a.smt < b.smt;
+        }
+
+        static bool coresOrder(const Cpu& a, const Cpu& b) {
+            if (a.smt != b.smt) return a.smt < b.smt;
+            return compactOrder(a, b);
+        }
+
+        static int readInt(const std::string& path, int fallback) {
+            FILE* f = fopen(path.c_str(), "r");
+            if (!f) return fallback;
+            int value;
+            if (fscanf(f, "%d", &value) != 1) value = fallback;
+            fclose(f);
+            return value;
+        }
+
+        // Parses a sysfs cpu list such as "0-3,8-11".
+        static std::vector<int> readList(const std::string& path) {
+            std::vector<int> result;
+            FILE* f = fopen(path.c_str(), "r");
+            if (!f) return result;
+            int lo, hi;
+            while (fscanf(f, "%d", &lo) == 1) {
+                hi = lo;
+                int c = fgetc(f);
+                if (c == '-') {
+                    if (fscanf(f, "%d", &hi) != 1) break;
+                    c = fgetc(f);
+                }
+                for (int i = lo; i <= hi; i++) result.push_back(i);
+                if (c != ',') break;
+            }
+            fclose(f);
+            return result;
+        }
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef _WORK_STEALING_DEQUE_H
+#define _WORK_STEALING_DEQUE_H
+
+#include <atomic>
+#include <vector>
+
+/*
+ * WorkStealingDeque: a Chase-Lev work-stealing deque, using the memory
+ * orderings from Le et al., "Correct and Efficient Work-Stealing for Weak
+ * Memory Models" (PPoPP '13).
+ *
+ * The owning thread pushes and pops at the bottom end, so it sees its own
+ * work in LIFO order.  Any other thread may steal from the top end.  The
+ * buffer grows when full; retired buffers are kept until the deque is
+ * destroyed because a concurrent thief may still be reading from them.
+ *
+ * T must be trivially copyable (in practice, a pointer).
+ */
+template <typename T>
+class WorkStealingDeque {
+    public:
+        WorkStealingDeque(int log_capacity = 8) {
+            _top.store(0);
+            _bottom.store(0);
+            _buffer.store(new Buffer(log_capacity));
+        }
+
+        ~WorkStealingDeque() {
+            delete _buffer.load();
+            for (size_t i = 0; i < _retired.size(); i++) {
+                delete _retired[i];
+            }
+        }
+
+        /*
+          Pushes an item onto the bottom of the deque.  Owner only.
+         */
+        void push(T item) {
+            long b = _bottom.load(std::memory_order_relaxed);
+            long t = _top.load(std::memory_order_acquire);
+            Buffer* buf = _buffer.load(std::memory_order_relaxed);
+            if (b - t > buf->mask) {
+                buf = grow(buf, t, b);
+            }
+            buf->put(b, item);
+            std::atomic_thread_fence(std::memory_order_release);
+            _bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        /*
+          Pops the most recently pushed item.  Owner only.  Returns false
+          if the deque is empty or the last item was lost to a thief.
+         */
+        bool pop(T* item) {
+            long b = _bottom.load(std::memory_order_relaxed) - 1;
+            Buffer* buf = _buffer.load(std::memory_order_relaxed);
+            _bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long t = _top.load(std::memory_order_relaxed);
+
+            if (t > b) {
+                // deque was empty
+                _bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+
+            *item = buf->get(b);
+            if (t == b) {
+                // last item: race against thieves for it
+                bool won = _top.compare_exchange_strong(t, t + 1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed);
+                _bottom.store(b + 1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+
+        /*
+          Steals the oldest item.  Safe to call from any thread.  Returns
+          false if the deque is empty or another thread won the race.
+         */
+        bool steal(T* item) {
+            long t = _top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long b = _bottom.load(std::memory_order_acquire);
+            if (t >= b) {
+                return false;
+            }
+
+            Buffer* buf = _buffer.load(std::memory_order_acquire);
+            T x = buf->get(t);
+            if (!_top.compare_exchange_strong(t, t + 1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return false;
+            }
+            *item = x;
+            return true;
+        }
+
+        /*
+          Approximate emptiness check, used to decide whether stealing from
+          this deque is worth attempting.
+         */
+        bool empty() const {
+            long t = _top.load(std::memory_order_relaxed);
+            long b = _bottom.load(std::memory_order_relaxed);
+            return b <= t;
+        }
+
+    private:
+        struct Buffer {
+            long mask;
+            std::atomic<T>* slots;
+
+            Buffer(int log_capacity) {
+                mask = (1L << log_capacity) - 1;
+                slots = new std::atomic<T>[mask + 1];
+            }
+            ~Buffer() { delete[] slots; }
+
+            T get(long i) {
+                return slots[i & mask].load(std::memory_order_relaxed);
+            }
+            void put(long i, T item) {
+                slots[i & mask].store(item, std::memory_order_relaxed);
+            }
+        };
+
+        Buffer* grow(Buffer* old, long t, long b) {
+            int log_capacity = 0;
+            while ((1L << log_capacity) <= old->mask) log_capacity++;
+
+            Buffer* buf = new Buffer(log_capacity + 1);
+            for (long i = t; i < b; i++) {
+                buf->put(i, old->get(i));
+            }
+            _retired.push_back(old);
+            _buffer.store(buf, std::memory_order_release);
+            return buf;
+        }
+
+        std::atomic<long> _top;
+        std::atomic<long> _bottom;
+        std::atomic<Buffer*> _buffer;
+        std::vector<Buffer*> _retired; // touched by the owner only
+};
+
+#endif
@@ -1,8 +1,12 @@
 #ifndef _ITASKSYS_H
 #define _ITASKSYS_H
+#include <atomic>
+#include <functional>
+#include <mutex>
 #include <vector>
 
 typedef int TaskID;
+class TaskGraph;
 
 class IRunnable {
     public:
@@ -18,6 +22,206 @@ class IRunnable {
              task launch.
          */
         virtual void runTask(int task_id, int num_total_tasks) = 0;
+
+        /*
+          Executes tasks begin through end-1 of a bulk task launch.
+          Engines call this once per chunk of tasks they hand to a
+          thread; the default implementation calls runTask() for each
+          task. Override it when the loop itself is worth inlining.
+         */
+        virtual void runTasks(int begin, int end, int num_total_tasks);
+
+        /*
+          Called instead of runTasks() for tasks begin through end-1 when
+          their launch was cancelled before they started (see
+          ITaskSystem::cancel()). The default implementation does
+          nothing.
+         */
+        virtual void skipTasks(int begin, int end, int num_total_tasks);
+};
+
+/*
+  IRunnable for kernels that work on a contiguous slice of task ids at a
+  time, e.g. to compute their partitioning once per slice or to let the
+  compiler vectorize across the elements of several tasks. Engines hand
+  every chunk they claim to runRange() in a single call.
+ */
+class IRangeRunnable: public IRunnable {
+    public:
+        /*
+          Executes tasks begin through end-1 of a bulk task launch.
+         */
+        virtual void runRange(int begin, int end, int num_total_tasks) = 0;
+
+        void runTask(int task_id, int num_total_tasks) {
+            runRange(task_id, task_id + 1, num_total_tasks);
+        }
+
+        void runTasks(int begin, int end, int num_total_tasks) {
+            runRange(begin, end, num_total_tasks);
+        }
+};
+
+/*
+  Adapts a callable f(task_id, num_total_tasks) to IRunnable. The loop in
+  runTasks() is instantiated for the callable's type, so a small body is
+  inlined into it and only the chunk, not every task, costs a virtual
+  call. See ITaskSystem::launch().
+ */
+template <typename F>
+class FunctionRunnable: public IRunnable {
+    public:
+        FunctionRunnable(const F& f) : _f(f) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            _f(task_id, num_total_tasks);
+        }
+
+        void runTasks(int begin, int end, int num_total_tasks) {
+            for (int i = begin; i < end; i++) {
+                _f(i, num_total_tasks);
+            }
+        }
+
+    private:
+        F _f;
+};
+
+/*
+  FunctionRunnable for asynchronous launches: owns a copy of the
+  callable and deletes itself once all of its tasks have run or been
+  skipped.
+ */
+template <typename F>
+class AsyncFunctionRunnable: public IRunnable {
+    public:
+        AsyncFunctionRunnable(const F& f, int num_total_tasks)
+            : _f(f), _tasksLeft(num_total_tasks) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            _f(task_id, num_total_tasks);
+            finish(1);
+        }
+
+        void runTasks(int begin, int end, int num_total_tasks) {
+            for (int i = begin; i < end; i++) {
+                _f(i, num_total_tasks);
+            }
+            finish(end - begin);
+        }
+
+        void skipTasks(int begin, int end, int num_total_tasks) {
+            finish(end - begin);
+        }
+
+    private:
+        F _f;
+        std::atomic<int> _tasksLeft;
+
+        void finish(int count) {
+            if (_tasksLeft.fetch_sub(count) == count) {
+                delete this;
+            }
+        }
+};
+
+/*
+  A runnable with nothing to run, for launches without tasks. It has no
+  state, so one instance serves every such launch.
+ */
+class EmptyRunnable: public IRunnable {
+    public:
+        void runTask(int task_id, int num_total_tasks) {}
+
+        static IRunnable* get() {
+            static EmptyRunnable instance;
+            return &instance;
+        }
+};
+
+/*
+  Which tasks of its dependencies a task of an asynchronous launch
+  waits for:
+
+    DEPEND_ALL          all tasks of every dependency (the default)
+    DEPEND_ELEMENTWISE  task i waits for task i of every dependency only
+    DEPEND_MAPPED       task i waits for task dependency_map(i) of every
+                        dependency only; like DEPEND_ALL if there is no
+                        dependency_map
+
+  The finer modes let a chain of bulk launches run as a pipeline instead
+  of in lockstep. A task whose index (or mapped index) is out of range for
+  a dependency does not wait for that dependency at all.
+ */
+enum DependencyMode {
+    DEPEND_ALL,
+    DEPEND_ELEMENTWISE,
+    DEPEND_MAPPED,
+};
+
+/*
+  Optional per-launch scheduling hints, accepted by the
+  runWithOptions()/runAsyncWithOptions() variants of ITaskSystem.
+  Engines are free to ignore any of them.
+ */
+struct LaunchOptions {
+    /*
+      Number of consecutive task ids a worker claims at once. 0 lets
+      the engine pick a chunk size from measured task durations.
+     */
+    int grain_size;
+
+    /*
+      Once ready, launches with a higher priority are started before
+      launches with a lower one. The default is 0.
+     */
+    int priority;
+
+    /*
+      How the launch depends on its deps. Only a hint as well: waiting
+      for all tasks of every dependency is always correct.
+     */
+    DependencyMode dependency_mode;
+    std::function<int(int)> dependency_map; // for DEPEND_MAPPED
+
+    /*
+      Worker pool to run the launch on, as returned by
+      ITaskSystem::addPool(). 0, the default, is the task system's own
+      workers.
+     */
+    int pool;
+
+    /*
+      Time after submission by which the launch should have finished,
+      in nanoseconds; 0 for none. Launches that finish later count as
+      deadline misses, and SCHEDULE_EARLIEST_DEADLINE starts the ready
+      launches with the earliest deadlines first.
+     */
+    long deadline_ns;
+
+    LaunchOptions()
+        : grain_size(0), priority(0), dependency_mode(DEPEND_ALL), pool(0), deadline_ns(0) {}
+};
+
+/*
+  How an engine orders launches that are ready to run:
+
+    SCHEDULE_FIFO           in the order they became ready (the default)
+    SCHEDULE_CRITICAL_PATH  longest chain of dependent work first, so
+                            that deep chains keep moving; a launch's
+                            chain is the tasks still ahead of it on the
+                            longest path through the launches submitted
+                            so far that depend on it, its own included
+    SCHEDULE_EARLIEST_DEADLINE
+                            launches with a deadline first, earliest
+                            deadline first; the others in FIFO order
+
+  LaunchOptions::priority takes precedence under any policy.
+ */
+enum SchedulingPolicy {
+    SCHEDULE_FIFO,
+    SCHEDULE_CRITICAL_PATH,
+    SCHEDULE_EARLIEST_DEADLINE,
 };
 
 class ITaskSystem {
@@ -61,10 +265,277 @@ class ITaskSystem {
         virtual TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                         const std::vector<TaskID>& deps) = 0;
 
+        /*
+          Same as run() and runAsyncWithDeps(), but with per-launch
+          scheduling hints. The default implementations ignore
+          `options`.
+         */
+        virtual void runWithOptions(IRunnable* runnable, int num_total_tasks,
+                                    const LaunchOptions& options);
+        virtual TaskID runAsyncWithOptions(IRunnable* runnable, int num_total_tasks,
+                                           const std::vector<TaskID>& deps,
+                                           const LaunchOptions& options);
+
+        /*
+          Selects how ready launches are ordered. Returns false if the
+          engine does not support the policy, in which case it keeps
+          running launches in FIFO order.
+         */
+        virtual bool setSchedulingPolicy(SchedulingPolicy policy);
+
+        /*
+          Number of launches with a LaunchOptions::deadline_ns that
+          finished after their deadline so far, or -1 if the engine does
+          not track deadlines.
+         */
+        virtual long deadlineMisses();
+
+        /*
+          Adds a pool of num_threads workers, which launches are directed
+          to with LaunchOptions::pool; e.g. a large pool for tasks that
+          block in syscalls, so that they do not tie up the workers that
+          compute-bound launches run on. Dependencies work across pools.
+          Returns the handle of the new pool. Engines without separate
+          pools return 0 and run everything on their own workers.
+         */
+        virtual int addPool(const char* name, int num_threads);
+
+        /*
+          Returns the handle of the pool added under `name`, or 0 if
+          there is none.
+         */
+        virtual int findPool(const char* name);
+
+        /*
+          Submits every launch of a TaskGraph recorded with
+          TaskGraphCapture (see TaskGraph.h), with the same dependencies
+          as if they had been passed to runAsyncWithDeps() in recording
+          order. Use sync() to wait for them. The default implementation
+          does just that; engines can instead instantiate the
+          precompiled graph in one go.
+         */
+        virtual void replay(const TaskGraph& graph);
+
+        /*
+          Same as run(), but takes a callable f(task_id, num_total_tasks)
+          instead of an IRunnable subclass:
+
+            t->launch(n, [&](int i, int n) { out[i] = i; });
+         */
+        template <typename F>
+        void launch(int num_total_tasks, const F& f,
+                    const LaunchOptions& options = LaunchOptions()) {
+            FunctionRunnable<F> runnable(f);
+            runWithOptions(&runnable, num_total_tasks, options);
+        }
+
+        /*
+          Same as runAsyncWithDeps(), but takes a callable. The callable
+          is copied, so anything it captures by reference must stay
+          alive until sync().
+         */
+        template <typename F>
+        TaskID launchAsync(int num_total_tasks, const F& f,
+                           const std::vector<TaskID>& deps = std::vector<TaskID>(),
+                           const LaunchOptions& options = LaunchOptions()) {
+            if (num_total_tasks <= 0) {
+                // no task will ever run to delete an adapter
+                return runAsyncWithOptions(EmptyRunnable::get(), 0, deps, options);
+            }
+            return runAsyncWithOptions(new AsyncFunctionRunnable<F>(f, num_total_tasks),
+                                       num_total_tasks, deps, options);
+        }
+
+        /*
+          Runs num_total_tasks tasks and combines their results:
+
+            long sum = t->parallelReduce(n, 0L,
+                [&](int i, int n) { return (long)a[i]; },
+                [](long x, long y) { return x + y; });
+
+          body(task_id, num_total_tasks) returns the result of one task.
+          combine must be associative and commutative, and `identity`
+          its neutral element; the order in which results are combined
+          is unspecified. Every thread folds the tasks it runs into its own
+          partial result, and the partials are combined pairwise at the
+          end, so the reduction takes a single bulk launch.
+         */
+        template <typename T, typename Body, typename Combine>
+        T parallelReduce(int num_total_tasks, const T& identity, const Body& body,
+                         const Combine& combine,
+                         const LaunchOptions& options = LaunchOptions());
+
+        /*
+          Number of worker threads whose partial results
+          parallelReduce() keeps apart. 0 if the task system has no
+          dedicated workers.
+         */
+        virtual int numWorkers();
+
+        /*
+          Index of the calling thread among this task system's workers,
+          or -1 if the caller is not one of them.
+         */
+        virtual int workerIndex() const;
+
         /*
           Blocks until all tasks created as a result of **any prior**
           runXXX calls are done.
          */
         virtual void sync() = 0;
+
+        /*
+          Blocks until the bulk task launch `id`, and with it every launch
+          it depends on, is done. Unlike sync(), unrelated launches may
+          still be running when wait() returns. The default
+          implementations of wait(), waitAll() and waitAny() fall back on
+          sync().
+         */
+        virtual void wait(TaskID id);
+
+        /*
+          Blocks until every launch in `ids` is done.
+         */
+        virtual void waitAll(const std::vector<TaskID>& ids);
+
+        /*
+          Blocks until at least one launch in `ids` is done and returns
+          its id, or -1 if `ids` is empty.
+         */
+        virtual TaskID waitAny(const std::vector<TaskID>& ids);
+
+        /*
+          Returns whether launch `id` is done, without waiting for it.
+          The default implementation calls sync() and returns true, which
+          is only non-blocking for engines that run launches eagerly.
+         */
+        virtual bool isDone(TaskID id);
+
+        /*
+          Cancels launch `id`. Its tasks that have not started will not
+          run, and neither will any task of the launches that depend on
+          it, directly or transitively; launches that only come to
+          depend on it after it has finished run normally. Tasks that
+          are already running finish normally. A cancelled launch is
+          done once those have returned and the launches it depends on
+          are done, so sync() and wait() on it still wait for upstream
+          work that was not cancelled, though not for any of its own
+          unstarted tasks; its onComplete() callbacks still run. Returns
+          false if the launch had already finished or the engine cannot
+          cancel launches; the default implementation always does.
+         */
+        virtual bool cancel(TaskID id);
+
+        /*
+          Runs fn() once launch `id` is done, on the thread that finishes
+          it, which in the pooled engines is usually a worker. If the
+          launch is already done, fn() runs on the calling thread before
+          onComplete() returns. sync() also waits for the callbacks of the
+          launches it waits for; wait() does not. fn() may launch more
+          work, but must not call sync() or wait on its own launch. The
+          default implementation waits for the launch and then calls
+          fn().
+         */
+        virtual void onComplete(TaskID id, const std::function<void()>& fn);
+
+        /*
+          Continuation: launches f over num_total_tasks tasks once launch
+          `id` is done, without a round trip through the caller, and
+          returns the new launch's id. Same as launchAsync() with `id` as
+          the only dependency.
+         */
+        template <typename F>
+        TaskID then(TaskID id, int num_total_tasks, const F& f,
+                    const LaunchOptions& options = LaunchOptions()) {
+            return launchAsync(num_total_tasks, f, std::vector<TaskID>(1, id), options);
+        }
+
+    protected:
+        /*
+          Called by a worker thread of this task system before it runs
+          any task.
+         */
+        void registerWorker(int worker_index);
 };
+
+/*
+  Implementation of ITaskSystem::parallelReduce(). Partials are padded
+  so that no two threads' partials share a cache line; threads that are
+  not workers of the task system share one partial under a lock.
+ */
+template <typename T, typename Body, typename Combine>
+class ReduceRunnable: public IRunnable {
+    public:
+        ReduceRunnable(ITaskSystem* system, const T& identity, const Body& body,
+                       const Combine& combine)
+            : _system(system), _identity(identity), _body(body), _combine(combine),
+              _partials(system->numWorkers() + 1) {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            runTasks(task_id, task_id + 1, num_total_tasks);
+        }
+
+        void runTasks(int begin, int end, int num_total_tasks) {
+            T acc = _identity;
+            for (int i = begin; i < end; i++) {
+                acc = _combine(acc, _body(i, num_total_tasks));
+            }
+
+            int index = _system->workerIndex();
+            if (index >= 0 && index + 1 < (int)_partials.size()) {
+                accumulate(_partials[index], acc);
+            } else {
+                std::lock_guard<std::mutex> lock(_sharedMutex);
+                accumulate(_partials.back(), acc);
+            }
+        }
+
+        /*
+          Combines the partials pairwise, in log2(#partials) rounds.
+         */
+        T result() {
+            std::vector<T> level;
+            for (size_t i = 0; i < _partials.size(); i++) {
+                if (_partials[i].used) level.push_back(_partials[i].value);
+            }
+            if (level.empty()) return _identity;
+            while (level.size() > 1) {
+                size_t half = (level.size() + 1) / 2;
+                for (size_t i = 0; i + half < level.size(); i++) {
+                    level[i] = _combine(level[i], level[i + half]);
+                }
+                level.resize(half);
+            }
+            return level[0];
+        }
+
+    private:
+        struct Partial {
+            T value;
+            bool used;
+            char pad[64]; // keeps neighbouring partials off this line
+
+            Partial() : used(false) {}
+        };
+
+        ITaskSystem* _system;
+        T _identity;
+        Body _body;
+        Combine _combine;
+        std::vector<Partial> _partials; // one per worker, then the shared one
+        std::mutex _sharedMutex;
+
+        void accumulate(Partial& partial, const T& acc) {
+            partial.value = partial.used ? _combine(partial.value, acc) : acc;
+            partial.used = true;
+        }
+};
+
+template <typename T, typename Body, typename Combine>
+T ITaskSystem::parallelReduce(int num_total_tasks, const T& identity, const Body& body,
+                              const Combine& combine, const LaunchOptions& options) {
+    ReduceRunnable<T, Body, Combine> runnable(this, identity, body, combine);
+    runWithOptions(&runnable, num_total_tasks, options);
+    return runnable.result();
+}
 #endif
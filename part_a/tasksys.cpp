@@ -2,9 +2,131 @@
 
 IRunnable::~IRunnable() {}
 
+void IRunnable::runTasks(int begin, int end, int num_total_tasks) {
+    for (int i = begin; i < end; i++) {
+        runTask(i, num_total_tasks);
+    }
+}
+
+void IRunnable::skipTasks(int begin, int end, int num_total_tasks) {}
+
 ITaskSystem::ITaskSystem(int num_threads) {}
 ITaskSystem::~ITaskSystem() {}
 
+// the task system whose worker the calling thread is, if any
+static thread_local const ITaskSystem* currentWorkerSystem = NULL;
+static thread_local int currentWorkerIndex = -1;
+
+int ITaskSystem::numWorkers() {
+    return 0;
+}
+
+int ITaskSystem::workerIndex() const {
+    return currentWorkerSystem == this ? currentWorkerIndex : -1;
+}
+
+void ITaskSystem::registerWorker(int worker_index) {
+    currentWorkerSystem = this;
+    currentWorkerIndex = worker_index;
+}
+
+/*
+ * TaskScope: marks the calling thread as running tasks of `system` for
+ * its lifetime. The engines in this part have room for one launch at a
+ * time, so a launch from inside one of their tasks runs inline on the
+ * calling thread.
+ */
+class TaskScope {
+    public:
+        TaskScope(const ITaskSystem* system) : _outer(current) {
+            current = system;
+        }
+
+        ~TaskScope() {
+            current = _outer;
+        }
+
+        static bool active(const ITaskSystem* system) {
+            return current == system;
+        }
+
+    private:
+        const ITaskSystem* _outer;
+        static thread_local const ITaskSystem* current;
+};
+
+thread_local const ITaskSystem* TaskScope::current = NULL;
+
+void ITaskSystem::runWithOptions(IRunnable* runnable, int num_total_tasks,
+                                 const LaunchOptions& options) {
+    run(runnable, num_total_tasks);
+}
+
+TaskID ITaskSystem::runAsyncWithOptions(IRunnable* runnable, int num_total_tasks,
+                                        const std::vector<TaskID>& deps,
+                                        const LaunchOptions& options) {
+    return runAsyncWithDeps(runnable, num_total_tasks, deps);
+}
+
+bool ITaskSystem::setSchedulingPolicy(SchedulingPolicy policy) {
+    return policy == SCHEDULE_FIFO;
+}
+
+long ITaskSystem::deadlineMisses() {
+    return -1;
+}
+
+int ITaskSystem::addPool(const char* name, int num_threads) {
+    return 0;
+}
+
+int ITaskSystem::findPool(const char* name) {
+    return 0;
+}
+
+void ITaskSystem::replay(const TaskGraph& graph) {
+    std::vector<TaskID> ids(graph.size());
+    std::vector<TaskID> deps;
+    for (int i = 0; i < graph.size(); i++) {
+        const TaskGraph::Node& node = graph.node(i);
+        deps.clear();
+        for (int dependency : node.dependencies) {
+            deps.push_back(ids[dependency]);
+        }
+        ids[i] = runAsyncWithOptions(node.runnable, node.numTotalTasks, deps, node.options);
+    }
+}
+
+void ITaskSystem::wait(TaskID id) {
+    sync();
+}
+
+void ITaskSystem::waitAll(const std::vector<TaskID>& ids) {
+    for (TaskID id : ids) {
+        wait(id);
+    }
+}
+
+TaskID ITaskSystem::waitAny(const std::vector<TaskID>& ids) {
+    if (ids.empty()) return -1;
+    sync();
+    return ids[0];
+}
+
+bool ITaskSystem::isDone(TaskID id) {
+    sync();
+    return true;
+}
+
+bool ITaskSystem::cancel(TaskID id) {
+    return false;
+}
+
+void ITaskSystem::onComplete(TaskID id, const std::function<void()>& fn) {
+    wait(id);
+    fn();
+}
+
 /*
  * ================================================================
  * Serial task system implementation
@@ -21,9 +143,7 @@ TaskSystemSerial::TaskSystemSerial(int num_threads): ITaskSystem(num_threads) {
 TaskSystemSerial::~TaskSystemSerial() {}
 
 void TaskSystemSerial::run(IRunnable* runnable, int num_total_tasks) {
-    for (int i = 0; i < num_total_tasks; i++) {
-        runnable->runTask(i, num_total_tasks);
-    }
+    runnable->runTasks(0, num_total_tasks, num_total_tasks);
 }
 
 TaskID TaskSystemSerial::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
@@ -67,9 +187,16 @@ void TaskSystemParallelSpawn::run(IRunnable* runnable, int num_total_tasks) {
     // method in Part A.  The implementation provided below runs all
     // tasks sequentially on the calling thread.
     //
+    if (TaskScope::active(this)) {
+        // nested launch: spawning another set of threads would
+        // oversubscribe the machine
+        runnable->runTasks(0, num_total_tasks, num_total_tasks);
+        return;
+    }
     std::thread* threads = new std::thread[_numThreads];
     for (int i = 0; i < _numThreads; i++) {
         threads[i] = std::thread([=] {
+            TaskScope scope(this);
             for (int j = i; j < num_total_tasks; j += _numThreads) {
                 runnable->runTask(j, num_total_tasks);
             }
@@ -98,23 +225,30 @@ void TaskSystemParallelSpawn::sync() {
  * ================================================================
  */
 
+int TaskSystemParallelThreadPoolSpinning::numWorkers() {
+    return _numThreads;
+}
+
 const char* TaskSystemParallelThreadPoolSpinning::name() {
     return "Parallel + Thread Pool + Spin";
 }
 
-TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads): ITaskSystem(num_threads) {
+TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads,
+                                                                           PlacementPolicy placement)
+    : ITaskSystem(num_threads) {
     //
     // TODO: CS149 student implementations may decide to perform setup
     // operations (such as thread pool construction) here.
     // Implementations are free to add new class member variables
     // (requiring changes to tasksys.h).
     //
+    _numThreads = num_threads;
+    _isDone = false;
     threads = new std::thread[num_threads];
     for (int i=0; i<num_threads; i++) {
-        threads[i] = std::thread(&TaskSystemParallelThreadPoolSpinning::threadLoop, this);
+        threads[i] = std::thread(&TaskSystemParallelThreadPoolSpinning::threadLoop, this, i);
     }
-    _numThreads = num_threads;
-    _isDone = false;
+    Topology::pinThreads(threads, num_threads, placement);
 }
 
 TaskSystemParallelThreadPoolSpinning::~TaskSystemParallelThreadPoolSpinning() {
@@ -126,6 +260,11 @@ TaskSystemParallelThreadPoolSpinning::~TaskSystemParallelThreadPoolSpinning() {
 }
 
 void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_total_tasks) {
+    runWithOptions(runnable, num_total_tasks, LaunchOptions());
+}
+
+void TaskSystemParallelThreadPoolSpinning::runWithOptions(IRunnable* runnable, int num_total_tasks,
+                                                          const LaunchOptions& options) {
 
 
     //
@@ -133,35 +272,64 @@ void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_tota
     // method in Part A.  The implementation provided below runs all
     // tasks sequentially on the calling thread.
     //
+    if (TaskScope::active(this)) {
+        // nested launch: the pool's one launch is the one calling us
+        runnable->runTasks(0, num_total_tasks, num_total_tasks);
+        return;
+    }
     _numTotalTasks = num_total_tasks;
     _completedTasks.store(0);
-    _queueMutex.lock();
-    for (int i = 0; i < num_total_tasks; i++) {
-        _taskQueue.push({runnable, i});
+    // guided self-scheduling: chunks shrink as the launch drains
+    int begin = 0;
+    while (begin < num_total_tasks) {
+        int chunk = _grain.chunkSize(num_total_tasks - begin, _numThreads, options.grain_size);
+        while (!_taskQueue.push({runnable, begin, begin + chunk})) {
+            std::this_thread::yield(); // full: workers are draining it
+        }
+        begin += chunk;
     }
-    _queueMutex.unlock();
 
+    // help drain the queue instead of idling until the workers are done
+    TaskRangeInfo range;
     while (_completedTasks.load() < _numTotalTasks) { // task is not done
-        std::this_thread::yield();
+        if (_taskQueue.pop(&range)) {
+            runRange(range);
+        } else {
+            std::this_thread::yield();
+        }
     }
 }
 
-void TaskSystemParallelThreadPoolSpinning::threadLoop() {
-    int taskId;
-    IRunnable* runnable;
-    while (!_isDone) {
-        taskId = -1;
-        _queueMutex.lock();
-        if (!_taskQueue.empty()) {
-            runnable = _taskQueue.front().first;
-            taskId = _taskQueue.front().second;
-            _taskQueue.pop();
-        }
-        _queueMutex.unlock();
-        if (taskId != -1) {
-            runnable->runTask(taskId, _numTotalTasks);
-            _completedTasks.fetch_add(1);
+void TaskSystemParallelThreadPoolSpinning::runRange(const TaskRangeInfo& range) {
+    long start = AdaptiveGrain::nowNs();
+    {
+        TaskScope scope(this);
+        range.runnable->runTasks(range.begin, range.end, _numTotalTasks);
+    }
+    _grain.record(range.end - range.begin, AdaptiveGrain::nowNs() - start);
+    _completedTasks.fetch_add(range.end - range.begin);
+}
+
+void TaskSystemParallelThreadPoolSpinning::threadLoop(int worker_id) {
+    registerWorker(worker_id);
+    TaskRangeInfo range;
+    // never parks, so a launch needs no wakeup: once the idle budget runs
+    // out the worker naps for as long again, but at least
+    // IdlePolicy::kMinBudgetNs, and polls anew
+    while (true) {
+        if (!_taskQueue.pop(&range)) {
+            long idle_start = IdlePolicy::nowNs();
+            auto ready = [this] { return _isDone || !_taskQueue.empty(); };
+            while (!_idle.spinWait(ready)) {
+                long nap = _idle.budgetNs();
+                if (nap < IdlePolicy::kMinBudgetNs) nap = IdlePolicy::kMinBudgetNs;
+                std::this_thread::sleep_for(std::chrono::nanoseconds(nap));
+            }
+            if (_isDone && _taskQueue.empty()) break;
+            _idle.recordIdle(IdlePolicy::nowNs() - idle_start);
+            continue;
         }
+        runRange(range);
     }
 }
 
@@ -182,23 +350,30 @@ void TaskSystemParallelThreadPoolSpinning::sync() {
  * ================================================================
  */
 
+int TaskSystemParallelThreadPoolSleeping::numWorkers() {
+    return _numThreads;
+}
+
 const char* TaskSystemParallelThreadPoolSleeping::name() {
     return "Parallel + Thread Pool + Sleep";
 }
 
-TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads): ITaskSystem(num_threads) {
+TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads,
+                                                                           PlacementPolicy placement)
+    : ITaskSystem(num_threads), _parking(num_threads) {
     //
     // TODO: CS149 student implementations may decide to perform setup
     // operations (such as thread pool construction) here.
     // Implementations are free to add new class member variables
     // (requiring changes to tasksys.h).
     //
+    _numThreads = num_threads;
+    _isDone = false;
     threads = new std::thread[num_threads];
     for (int i=0; i<num_threads; i++) {
-        threads[i] = std::thread(&TaskSystemParallelThreadPoolSleeping::threadLoop, this);
+        threads[i] = std::thread(&TaskSystemParallelThreadPoolSleeping::threadLoop, this, i);
     }
-    _numThreads = num_threads;
-    _isDone = false;
+    Topology::pinThreads(threads, num_threads, placement);
 }
 
 TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
@@ -209,7 +384,7 @@ TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
     // (requiring changes to tasksys.h).
     //
     _isDone = true;
-    _queueCond.notify_all();
+    _parking.unparkAll();
     for (int i = 0; i < _numThreads; i++) {
         threads[i].join();
     }
@@ -217,6 +392,11 @@ TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
 }
 
 void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks) {
+    runWithOptions(runnable, num_total_tasks, LaunchOptions());
+}
+
+void TaskSystemParallelThreadPoolSleeping::runWithOptions(IRunnable* runnable, int num_total_tasks,
+                                                          const LaunchOptions& options) {
 
 
     //
@@ -224,36 +404,61 @@ void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_tota
     // method in Parts A and B.  The implementation provided below runs all
     // tasks sequentially on the calling thread.
     //
+    if (TaskScope::active(this)) {
+        // nested launch: the pool's one launch is the one calling us
+        runnable->runTasks(0, num_total_tasks, num_total_tasks);
+        return;
+    }
     _numTotalTasks = num_total_tasks;
     _completedTasks.store(0);
-    _queueMutex.lock();
-    for (int i = 0; i < num_total_tasks; i++) {
-        _taskQueue.push({runnable, i});
+    // guided self-scheduling: chunks shrink as the launch drains
+    int begin = 0;
+    while (begin < num_total_tasks) {
+        int chunk = _grain.chunkSize(num_total_tasks - begin, _numThreads, options.grain_size);
+        while (!_taskQueue.push({runnable, begin, begin + chunk})) {
+            std::this_thread::yield(); // full: workers are draining it
+        }
+        // one parked worker per range; spinning workers find it themselves
+        _parking.unpark(1);
+        begin += chunk;
     }
-    _queueMutex.unlock();
-    _queueCond.notify_all();
 
+    // help drain the queue instead of idling until the workers are done
+    TaskRangeInfo range;
     while (_completedTasks.load() < _numTotalTasks) { // task is not done
-        std::this_thread::yield();
+        if (_taskQueue.pop(&range)) {
+            runRange(range);
+        } else {
+            std::this_thread::yield();
+        }
     }
 }
 
-void TaskSystemParallelThreadPoolSleeping::threadLoop() {
-    int taskId;
-    IRunnable* runnable;
-    while (true) {
-        std::unique_lock<std::mutex> lock(_queueMutex);
-        _queueCond.wait(lock, [this] {
-            return _isDone || !_taskQueue.empty();
-        });
+void TaskSystemParallelThreadPoolSleeping::runRange(const TaskRangeInfo& range) {
+    long start = AdaptiveGrain::nowNs();
+    {
+        TaskScope scope(this);
+        range.runnable->runTasks(range.begin, range.end, _numTotalTasks);
+    }
+    _grain.record(range.end - range.begin, AdaptiveGrain::nowNs() - start);
+    _completedTasks.fetch_add(range.end - range.begin);
+}
 
-        if (_isDone && _taskQueue.empty()) break;
-        runnable = _taskQueue.front().first;
-        taskId = _taskQueue.front().second;
-        _taskQueue.pop();
-        lock.unlock();
-        runnable->runTask(taskId, _numTotalTasks);
-        _completedTasks.fetch_add(1);
+void TaskSystemParallelThreadPoolSleeping::threadLoop(int worker_id) {
+    registerWorker(worker_id);
+    TaskRangeInfo range;
+    while (true) {
+        if (!_taskQueue.pop(&range)) {
+            long idle_start = IdlePolicy::nowNs();
+            auto ready = [this] { return _isDone || !_taskQueue.empty(); };
+            if (!_idle.spinWait(ready)) {
+                _parking.park(worker_id, ready);
+            }
+            if (_isDone && _taskQueue.empty()) break;
+            _idle.recordIdle(IdlePolicy::nowNs() - idle_start);
+            continue;
+        }
+        runRange(range);
     }
 }
 
@@ -276,3 +481,39 @@ void TaskSystemParallelThreadPoolSleeping::sync() {
 
     return;
 }
+
+/*
+ * ================================================================
+ * Parallel Thread Pool Work Stealing Task System Implementation
+ * ================================================================
+ */
+
+const char* TaskSystemParallelThreadPoolStealing::name() {
+    return "Parallel + Thread Pool + Steal";
+}
+
+TaskSystemParallelThreadPoolStealing::TaskSystemParallelThreadPoolStealing(int num_threads,
+                                                                           PlacementPolicy placement)
+    : ITaskSystem(num_threads) {
+    // NOTE: the work-stealing task system is only implemented in Part B.
+}
+
+TaskSystemParallelThreadPoolStealing::~TaskSystemParallelThreadPoolStealing() {}
+
+void TaskSystemParallelThreadPoolStealing::run(IRunnable* runnable, int num_total_tasks) {
+    // NOTE: the work-stealing task system is only implemented in Part B.
+    for (int i = 0; i < num_total_tasks; i++) {
+        runnable->runTask(i, num_total_tasks);
+    }
+}
+
+TaskID TaskSystemParallelThreadPoolStealing::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                              const std::vector<TaskID>& deps) {
+    // You do not need to implement this method.
+    return 0;
+}
+
+void TaskSystemParallelThreadPoolStealing::sync() {
+    // You do not need to implement this method.
+    return;
+}
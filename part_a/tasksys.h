@@ -7,6 +7,18 @@
 #include <atomic>
 #include <thread>
 #include <condition_variable>
+#include "AdaptiveGrain.h"
+#include "MPMCQueue.h"
+#include "IdlePolicy.h"
+#include "ParkingLot.h"
+#include "Topology.h"
+#include "TaskGraph.h"
+
+typedef struct _TaskRangeInfo {
+    IRunnable* runnable;
+    int begin; // first task id of the chunk
+    int end;   // one past the last task id
+} TaskRangeInfo;
 
 /*
  * TaskSystemSerial: This class is the student's implementation of a
@@ -51,22 +63,28 @@ class TaskSystemParallelSpawn: public ITaskSystem {
  */
 class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSpinning(int num_threads);
+        TaskSystemParallelThreadPoolSpinning(int num_threads,
+                                             PlacementPolicy placement = PLACEMENT_NONE);
         ~TaskSystemParallelThreadPoolSpinning();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
+        void runWithOptions(IRunnable* runnable, int num_total_tasks,
+                            const LaunchOptions& options);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
         void sync();
+        int numWorkers();
     private:
         int _numThreads;
         std::thread* threads;
-        std::queue<std::pair<IRunnable*, int>> _taskQueue;
-        std::mutex _queueMutex;
+        MPMCQueue<TaskRangeInfo> _taskQueue;
         std::atomic<int> _completedTasks;
         int _numTotalTasks;
-        bool _isDone;
-        void threadLoop();
+        AdaptiveGrain _grain;
+        IdlePolicy _idle;
+        std::atomic<bool> _isDone;
+        void threadLoop(int worker_id);
+        void runRange(const TaskRangeInfo& range);
 };
 
 /*
@@ -77,23 +95,46 @@ class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
  */
 class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSleeping(int num_threads);
+        TaskSystemParallelThreadPoolSleeping(int num_threads,
+                                             PlacementPolicy placement = PLACEMENT_NONE);
         ~TaskSystemParallelThreadPoolSleeping();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
+        void runWithOptions(IRunnable* runnable, int num_total_tasks,
+                            const LaunchOptions& options);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
         void sync();
+        int numWorkers();
     private:
         int _numThreads;
         std::thread* threads;
-        std::queue<std::pair<IRunnable*, int>> _taskQueue;
-        std::mutex _queueMutex;
+        MPMCQueue<TaskRangeInfo> _taskQueue;
+        ParkingLot _parking; // idle workers
         std::atomic<int> _completedTasks;
-        std::condition_variable _queueCond;
         int _numTotalTasks;
-        bool _isDone;
-        void threadLoop();
+        AdaptiveGrain _grain;
+        IdlePolicy _idle;
+        std::atomic<bool> _isDone;
+        void threadLoop(int worker_id);
+        void runRange(const TaskRangeInfo& range);
+};
+
+/*
+ * TaskSystemParallelThreadPoolStealing: work-stealing thread pool. Only
+ * implemented in Part B; see part_b/tasksys.h. See definition of
+ * ITaskSystem in itasksys.h for documentation of the ITaskSystem interface.
+ */
+class TaskSystemParallelThreadPoolStealing: public ITaskSystem {
+    public:
+        TaskSystemParallelThreadPoolStealing(int num_threads,
+                                             PlacementPolicy placement = PLACEMENT_NONE);
+        ~TaskSystemParallelThreadPoolStealing();
+        const char* name();
+        void run(IRunnable* runnable, int num_total_tasks);
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps);
+        void sync();
 };
 
 #endif
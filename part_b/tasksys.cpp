@@ -3,9 +3,209 @@
 
 IRunnable::~IRunnable() {}
 
+void IRunnable::runTasks(int begin, int end, int num_total_tasks) {
+    for (int i = begin; i < end; i++) {
+        runTask(i, num_total_tasks);
+    }
+}
+
+void IRunnable::skipTasks(int begin, int end, int num_total_tasks) {}
+
 ITaskSystem::ITaskSystem(int num_threads) {}
 ITaskSystem::~ITaskSystem() {}
 
+// the task system whose worker the calling thread is, if any
+static thread_local const ITaskSystem* currentWorkerSystem = NULL;
+static thread_local int currentWorkerIndex = -1;
+
+int ITaskSystem::numWorkers() {
+    return 0;
+}
+
+int ITaskSystem::workerIndex() const {
+    return currentWorkerSystem == this ? currentWorkerIndex : -1;
+}
+
+void ITaskSystem::registerWorker(int worker_index) {
+    currentWorkerSystem = this;
+    currentWorkerIndex = worker_index;
+}
+
+/*
+ * TaskScope: marks the calling thread as running tasks of `system` for
+ * its lifetime, and collects the launches those tasks submit. A sync()
+ * from inside a task cannot wait for everything, since the enclosing
+ * launch only finishes once the task returns, so it waits for these
+ * child launches instead. Scopes nest with the tasks that open them.
+ */
+class TaskScope {
+    public:
+        TaskScope(const ITaskSystem* system) : _system(system), _outer(current) {
+            current = this;
+        }
+
+        ~TaskScope() {
+            current = _outer;
+        }
+
+        // Returns the innermost scope of `system` on this thread, or NULL.
+        static TaskScope* of(const ITaskSystem* system) {
+            return (current != NULL && current->_system == system) ? current : NULL;
+        }
+
+        std::vector<TaskID> children;
+
+    private:
+        const ITaskSystem* _system;
+        TaskScope* _outer;
+        static thread_local TaskScope* current;
+};
+
+thread_local TaskScope* TaskScope::current = NULL;
+
+void ITaskSystem::runWithOptions(IRunnable* runnable, int num_total_tasks,
+                                 const LaunchOptions& options) {
+    run(runnable, num_total_tasks);
+}
+
+TaskID ITaskSystem::runAsyncWithOptions(IRunnable* runnable, int num_total_tasks,
+                                        const std::vector<TaskID>& deps,
+                                        const LaunchOptions& options) {
+    return runAsyncWithDeps(runnable, num_total_tasks, deps);
+}
+
+bool ITaskSystem::setSchedulingPolicy(SchedulingPolicy policy) {
+    return policy == SCHEDULE_FIFO;
+}
+
+long ITaskSystem::deadlineMisses() {
+    return -1;
+}
+
+int ITaskSystem::addPool(const char* name, int num_threads) {
+    return 0;
+}
+
+int ITaskSystem::findPool(const char* name) {
+    return 0;
+}
+
+void ITaskSystem::replay(const TaskGraph& graph) {
+    std::vector<TaskID> ids(graph.size());
+    std::vector<TaskID> deps;
+    for (int i = 0; i < graph.size(); i++) {
+        const TaskGraph::Node& node = graph.node(i);
+        deps.clear();
+        for (int dependency : node.dependencies) {
+            deps.push_back(ids[dependency]);
+        }
+        ids[i] = runAsyncWithOptions(node.runnable, node.numTotalTasks, deps, node.options);
+    }
+}
+
+void ITaskSystem::wait(TaskID id) {
+    sync();
+}
+
+void ITaskSystem::waitAll(const std::vector<TaskID>& ids) {
+    for (TaskID id : ids) {
+        wait(id);
+    }
+}
+
+TaskID ITaskSystem::waitAny(const std::vector<TaskID>& ids) {
+    if (ids.empty()) return -1;
+    sync();
+    return ids[0];
+}
+
+bool ITaskSystem::isDone(TaskID id) {
+    sync();
+    return true;
+}
+
+bool ITaskSystem::cancel(TaskID id) {
+    return false;
+}
+
+void ITaskSystem::onComplete(TaskID id, const std::function<void()>& fn) {
+    wait(id);
+    fn();
+}
+
+/*
+ * ================================================================
+ * Task group table
+ * ================================================================
+ */
+
+TaskGroupTable::TaskGroupTable(int log_capacity) {
+    int capacity = 1 << log_capacity;
+    TaskGroupInfo* block = new TaskGroupInfo[capacity];
+    _blocks.push_back(block);
+    _slots.resize(capacity);
+    _generations.assign(capacity, 0);
+    for (int i = 0; i < capacity; i++) {
+        block[i].id = -1;
+        block[i].waiters = 0;
+        _slots[i] = &block[i];
+        _free.push_back(i);
+    }
+}
+
+TaskGroupTable::~TaskGroupTable() {
+    for (size_t i = 0; i < _blocks.size(); i++) {
+        delete[] _blocks[i];
+    }
+}
+
+TaskGroupInfo* TaskGroupTable::insert() {
+    if (_free.empty()) {
+        grow();
+    }
+    int index = _free.front();
+    _free.pop_front();
+    TaskGroupInfo* group = _slots[index];
+    group->id = (_generations[index] << kIndexBits) | index;
+    return group;
+}
+
+TaskGroupInfo* TaskGroupTable::find(TaskID id) {
+    int index = id & kIndexMask;
+    if (index >= (int)_slots.size()) return NULL;
+    TaskGroupInfo* group = _slots[index];
+    return (group->id == id) ? group : NULL;
+}
+
+void TaskGroupTable::release(TaskGroupInfo* group) {
+    int index = group->id & kIndexMask;
+    group->id = -1;
+    _generations[index] = (_generations[index] + 1) % kGenerations;
+    _free.push_back(index);
+}
+
+/*
+ * Doubles the table. Live groups keep their slots, and with them their
+ * ids; the new slots are appended to the free list.
+ */
+void TaskGroupTable::grow() {
+    int capacity = _slots.size();
+    if (capacity > kIndexMask) {
+        fprintf(stderr, "TaskGroupTable: more than %d launches in flight\n", kIndexMask + 1);
+        abort();
+    }
+    TaskGroupInfo* block = new TaskGroupInfo[capacity];
+    _blocks.push_back(block);
+    _slots.resize(2 * capacity);
+    _generations.resize(2 * capacity, 0);
+    for (int i = 0; i < capacity; i++) {
+        block[i].id = -1;
+        block[i].waiters = 0;
+        _slots[capacity + i] = &block[i];
+        _free.push_back(capacity + i);
+    }
+}
+
 /*
  * ================================================================
  * Serial task system implementation
@@ -22,16 +222,12 @@ TaskSystemSerial::TaskSystemSerial(int num_threads): ITaskSystem(num_threads) {
 TaskSystemSerial::~TaskSystemSerial() {}
 
 void TaskSystemSerial::run(IRunnable* runnable, int num_total_tasks) {
-    for (int i = 0; i < num_total_tasks; i++) {
-        runnable->runTask(i, num_total_tasks);
-    }
+    runnable->runTasks(0, num_total_tasks, num_total_tasks);
 }
 
 TaskID TaskSystemSerial::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                           const std::vector<TaskID>& deps) {
-    for (int i = 0; i < num_total_tasks; i++) {
-        runnable->runTask(i, num_total_tasks);
-    }
+    runnable->runTasks(0, num_total_tasks, num_total_tasks);
 
     return 0;
 }
@@ -88,7 +284,9 @@ const char* TaskSystemParallelThreadPoolSpinning::name() {
     return "Parallel + Thread Pool + Spin";
 }
 
-TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads): ITaskSystem(num_threads) {
+TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads,
+                                                                           PlacementPolicy placement)
+    : ITaskSystem(num_threads) {
     // NOTE: CS149 students are not expected to implement TaskSystemParallelThreadPoolSpinning in Part B.
 }
 
@@ -122,135 +320,1426 @@ void TaskSystemParallelThreadPoolSpinning::sync() {
  * ================================================================
  */
 
+int TaskSystemParallelThreadPoolSleeping::numWorkers() {
+    return _numWorkers.load();
+}
+
+int TaskSystemParallelThreadPoolSleeping::numLiveWorkers() {
+    return _liveThreads.load();
+}
+
 const char* TaskSystemParallelThreadPoolSleeping::name() {
     return "Parallel + Thread Pool + Sleep";
 }
 
-TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads): ITaskSystem(num_threads) {
-    //
-    // TODO: CS149 student implementations may decide to perform setup
-    // operations (such as thread pool construction) here.
-    // Implementations are free to add new class member variables
-    // (requiring changes to tasksys.h).
-    //
-    threads = new std::thread[num_threads];
-    for (int i=0; i<num_threads; i++) {
-        threads[i] = std::thread(&TaskSystemParallelThreadPoolSleeping::threadLoop, this);
+TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads,
+                                                                           PlacementPolicy placement)
+    : TaskSystemParallelThreadPoolSleeping(num_threads, num_threads, placement) {}
+
+TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int min_threads,
+                                                                           int max_threads,
+                                                                           PlacementPolicy placement)
+    : ITaskSystem(max_threads), _parking(max_threads) {
+    _numThreads = max_threads;
+    _minThreads = std::max(1, std::min(min_threads, max_threads));
+    _numNodes = Topology::get().numNodes();
+    _readyQueues = new MPMCQueue<TaskGroupInfo*>[_numNodes];
+    _numSubmitted = 0;
+    _activeTaskGroups.store(0);
+    _overflowCount.store(0);
+    _anyWaiters = 0;
+    _finishEpoch.store(0);
+    _callbackGroups.store(0);
+    _priorityCount.store(0);
+    _criticalPath.store(false);
+    _earliestDeadline.store(false);
+    _deadlineMisses.store(0);
+    _rangeCount.store(0);
+    _numPools = 1;
+    _numWorkers.store(max_threads);
+    _liveThreads.store(_minThreads);
+    _idleThreads.store(0);
+    _lastGrowNs.store(0);
+    _growRequested.store(false);
+    _slotLive.assign(max_threads, false);
+    if (placement != PLACEMENT_NONE) {
+        _cpus = Topology::get().placement(placement, max_threads);
     }
-    _numThreads = num_threads;
-    _nextTaskGroupId.store(0);
     _isDone = false;
+    threads = new std::thread[max_threads];
+    for (int i = 0; i < _minThreads; i++) {
+        _slotLive[i] = true;
+        threads[i] = std::thread(&TaskSystemParallelThreadPoolSleeping::threadLoop, this, i);
+        if (!_cpus.empty()) Topology::pin(threads[i], _cpus[i]);
+    }
 }
 
 TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
-    //
-    // TODO: CS149 student implementations may decide to perform cleanup
-    // operations (such as thread pool shutdown construction) here.
-    // Implementations are free to add new class member variables
-    // (requiring changes to tasksys.h).
-    //
-    _isDone = true;
-    _worker_cv.notify_all();
+    {
+        // no worker can be added from here on
+        std::lock_guard<std::mutex> lock(_elasticMutex);
+        _isDone = true;
+    }
+    _parking.unparkAll();
+    for (int p = 1; p < _numPools; p++) {
+        std::lock_guard<std::mutex> lock(_pools[p]->mutex);
+        _pools[p]->cv.notify_all();
+    }
+    // every thread can reach the ready queues and the pools, so only
+    // free them once all have exited
     for (int i = 0; i < _numThreads; i++) {
-        threads[i].join();
+        if (threads[i].joinable()) threads[i].join();
+    }
+    for (int p = 1; p < _numPools; p++) {
+        for (int i = 0; i < _pools[p]->numThreads; i++) {
+            _pools[p]->threads[i].join();
+        }
     }
     delete[] threads;
+    delete[] _readyQueues;
+    for (int p = 1; p < _numPools; p++) {
+        delete[] _pools[p]->threads;
+        delete _pools[p];
+    }
+}
+
+/*
+ * Starts the pool's threads right away. Their worker indices follow
+ * those of the pools added before.
+ */
+int TaskSystemParallelThreadPoolSleeping::addPool(const char* name, int num_threads) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_numPools == kMaxPools || num_threads <= 0) return 0;
+    WorkerPool* pool = new WorkerPool;
+    pool->name = name;
+    pool->numThreads = num_threads;
+    pool->threads = new std::thread[num_threads];
+    int first_worker = _numWorkers.fetch_add(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        pool->threads[i] = std::thread(&TaskSystemParallelThreadPoolSleeping::poolLoop, this,
+                                       pool, first_worker + i);
+    }
+    _pools[_numPools] = pool;
+    return _numPools++;
+}
+
+int TaskSystemParallelThreadPoolSleeping::findPool(const char* name) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (int p = 1; p < _numPools; p++) {
+        if (_pools[p]->name == name) return p;
+    }
+    return 0;
 }
 
 void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks) {
+    runWithOptions(runnable, num_total_tasks, LaunchOptions());
+}
 
+void TaskSystemParallelThreadPoolSleeping::runWithOptions(IRunnable* runnable, int num_total_tasks,
+                                                          const LaunchOptions& options) {
+    TaskID id = runAsyncWithOptions(runnable, num_total_tasks, {}, options);
+    // the caller is blocked on this launch anyway, so it helps with the
+    // queued work, which is mostly this launch's, before it waits for
+    // the chunks still running
+    TaskRangeInfo range;
+    while (!isDone(id) && (popRange(&range) || popReady(&range))) {
+        runRange(range);
+    }
+    wait(id);
+}
 
-    //
-    // TODO: CS149 students will modify the implementation of this
-    // method in Parts A and B.  The implementation provided below runs all
-    // tasks sequentially on the calling thread.
-    //
-    runAsyncWithDeps(runnable, num_total_tasks, {});
-    sync();
+void TaskSystemParallelThreadPoolSleeping::threadLoop(int worker_id) {
+    registerWorker(worker_id);
+    TaskRangeInfo range;
+    while (true) {
+        if (popRange(&range)) {
+            runRange(range);
+            continue;
+        }
+        if (!popReady(&range)) {
+            // spin while the next launch is likely close, then park
+            long idle_start = IdlePolicy::nowNs();
+            auto ready = [this] { return _isDone || hasReady(); };
+            bool timed_out = false;
+            _idleThreads.fetch_add(1);
+            if (!_idle.spinWait(ready)) {
+                if (_liveThreads.load() > _minThreads) {
+                    timed_out = !_parking.parkFor(worker_id, ready, kRetireAfterNs);
+                } else {
+                    _parking.park(worker_id, ready);
+                }
+            }
+            _idleThreads.fetch_sub(1);
+            if (timed_out && retireWorker(worker_id)) return;
+            if (_isDone && !hasReady()) break;
+            _idle.recordIdle(IdlePolicy::nowNs() - idle_start);
+            continue;
+        }
+        runRange(range);
+    }
 }
 
-void TaskSystemParallelThreadPoolSleeping::threadLoop() {
+void TaskSystemParallelThreadPoolSleeping::poolLoop(WorkerPool* pool, int worker_id) {
+    registerWorker(worker_id);
     while (true) {
-        std::unique_lock<std::mutex> lock(_mutex);
-        _worker_cv.wait(lock, [this] {
-            return _isDone || !_taskQueue.empty();
-        });
+        TaskGroupInfo* group = NULL;
+        TaskRangeInfo range;
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->cv.wait(lock, [this, pool] {
+                return _isDone || !pool->ready.empty() || !pool->ranges.empty();
+            });
+            if (!pool->ranges.empty()) {
+                range = pool->ranges.front();
+                pool->ranges.pop_front();
+            } else if (!pool->ready.empty()) {
+                group = pool->ready.front();
+                pool->ready.pop_front();
+            } else {
+                break;
+            }
+        }
+        if (group != NULL) {
+            range = takeChunk(group);
+        }
+        runRange(range);
+    }
+}
+
+/*
+ * Elastic mode: notes that a worker should be added if none of the live
+ * ones is idle, i.e. all of them are running or blocked in tasks while
+ * work is queued. Called whenever work is queued, often with _mutex held,
+ * so the thread is only started by maybeGrow(); a no-op once all slots
+ * are live.
+ */
+void TaskSystemParallelThreadPoolSleeping::requestGrow() {
+    if (_liveThreads.load() >= _numThreads || _idleThreads.load() > 0) return;
+    _growRequested.store(true);
+}
+
+/*
+ * Adds the worker requestGrow() asked for, if no live one has gone idle
+ * in the meantime. Called without _mutex by whoever queued the work, once
+ * it is done with the scheduler's state.
+ */
+void TaskSystemParallelThreadPoolSleeping::maybeGrow() {
+    if (!_growRequested.load() || !_growRequested.exchange(false)) return;
+    if (_liveThreads.load() >= _numThreads || _idleThreads.load() > 0) return;
+    long now = IdlePolicy::nowNs();
+    long last = _lastGrowNs.load();
+    if (now - last < kGrowIntervalNs || !_lastGrowNs.compare_exchange_strong(last, now)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_elasticMutex);
+    if (_isDone) return;
+    for (int i = 0; i < _numThreads; i++) {
+        if (_slotLive[i]) continue;
+        if (threads[i].joinable()) {
+            // a retired worker, which has already left threadLoop()
+            threads[i].join();
+        }
+        _slotLive[i] = true;
+        _liveThreads.fetch_add(1);
+        threads[i] = std::thread(&TaskSystemParallelThreadPoolSleeping::threadLoop, this, i);
+        if (!_cpus.empty()) Topology::pin(threads[i], _cpus[i]);
+        return;
+    }
+}
+
+/*
+ * Called by a worker beyond the minimum that stayed parked for
+ * kRetireAfterNs. It no longer counts as idle at this point, so either it
+ * sees work queued meanwhile and stays, or whoever queued it sees no idle
+ * worker and adds one.
+ */
+bool TaskSystemParallelThreadPoolSleeping::retireWorker(int worker_id) {
+    std::lock_guard<std::mutex> lock(_elasticMutex);
+    if (_isDone || _liveThreads.load() <= _minThreads || hasReady()) return false;
+    _slotLive[worker_id] = false;
+    _liveThreads.fetch_sub(1);
+    return true;
+}
+
+void TaskSystemParallelThreadPoolSleeping::wakePool(WorkerPool* pool, int wake_count) {
+    if (wake_count >= pool->numThreads) {
+        pool->cv.notify_all();
+        return;
+    }
+    for (int i = 0; i < wake_count; i++) {
+        pool->cv.notify_one();
+    }
+}
+
+AdaptiveGrain& TaskSystemParallelThreadPoolSleeping::grainOf(TaskGroupInfo* group) {
+    return (group->pool == 0) ? _grain : _pools[group->pool]->grain;
+}
+
+int TaskSystemParallelThreadPoolSleeping::threadsOf(TaskGroupInfo* group) {
+    return (group->pool == 0) ? _liveThreads.load(std::memory_order_relaxed)
+                              : _pools[group->pool]->numThreads;
+}
+
+/*
+ * Claims the next chunk of a launch. The caller must be the only one
+ * claiming from it: it holds the launch's only entry in a FIFO queue, or
+ * _priorityMutex for a launch in the priority queue.
+ */
+TaskRangeInfo TaskSystemParallelThreadPoolSleeping::claimChunk(TaskGroupInfo* group) {
+    int begin = group->nextTask.load(std::memory_order_relaxed);
+    int chunk;
+    if (group->cancelled.load()) {
+        // claim and skip everything that has not started
+        chunk = group->numTotalTasks - begin;
+    } else {
+        chunk = grainOf(group).chunkSize(group->numTotalTasks - begin, threadsOf(group),
+                                         group->grainSize);
+    }
+    group->nextTask.store(begin + chunk, std::memory_order_relaxed);
+    TaskRangeInfo range = {group, begin, begin + chunk};
+    return range;
+}
+
+/*
+ * Claims a chunk of a launch popped from a FIFO queue, and puts the
+ * launch back before the chunk runs if tasks are left, so that other
+ * workers can join in. releaseGroup() already woke as many workers as
+ * the launch can use.
+ */
+TaskRangeInfo TaskSystemParallelThreadPoolSleeping::takeChunk(TaskGroupInfo* group) {
+    TaskRangeInfo range = claimChunk(group);
+    if (range.end < group->numTotalTasks) {
+        pushReady(group, 0);
+        maybeGrow();
+    }
+    return range;
+}
 
-        if (_isDone && _taskQueue.empty()) break;
-        TaskUnitInfo* currentTaskUnit = _taskQueue.front();
-        _taskQueue.pop();
-        lock.unlock();
-
-        currentTaskUnit->runnable->runTask(currentTaskUnit->id, currentTaskUnit->group->numTotalTasks);
-        
-        lock.lock();
-        if (currentTaskUnit->group->completedTasks.fetch_add(1) == currentTaskUnit->group->numTotalTasks - 1) {
-            // dependency check
-            for (TaskID dependentID : currentTaskUnit->group->dependents) {
-                TaskGroupInfo* dependentTaskGroup = _allTaskGroups[dependentID];
-                if (dependentTaskGroup->dependenciesLeft.fetch_sub(1) == 1) {
-                    for (int i = 0; i < dependentTaskGroup -> numTotalTasks; i++) {
-                        _taskQueue.push(new TaskUnitInfo{i, dependentTaskGroup->runnable, dependentTaskGroup});
+/*
+ * Runs a claimed chunk of a launch, or a range released by releaseTasks().
+ * Other workers may be running other parts of the same launch.
+ */
+void TaskSystemParallelThreadPoolSleeping::runRange(const TaskRangeInfo& range) {
+    TaskGroupInfo* group = range.group;
+    if (group->cancelled.load()) {
+        group->runnable->skipTasks(range.begin, range.end, group->numTotalTasks);
+    } else {
+        long start = AdaptiveGrain::nowNs();
+        {
+            TaskScope scope(this);
+            group->runnable->runTasks(range.begin, range.end, group->numTotalTasks);
+        }
+        grainOf(group).record(range.end - range.begin, AdaptiveGrain::nowNs() - start);
+    }
+    completeRange(group, range.begin, range.end);
+}
+
+/*
+ * Called after tasks [begin, end) of a launch have run or been skipped:
+ * releases the tasks of later launches that were waiting for exactly
+ * these, and retires the launch once all of its tasks are done.
+ */
+void TaskSystemParallelThreadPoolSleeping::completeRange(TaskGroupInfo* group, int begin, int end) {
+    // pairs with addTaskDependencies(): either a new fine dependent sees
+    // this count, or we see its keepRanges
+    group->completedRanges.fetch_add(1);
+    size_t num_dependents = 0;
+    if (group->keepRanges.load()) {
+        // dependents registered after this point see the range in doneRanges
+        // and must not be told about it again
+        std::lock_guard<std::mutex> lock(group->rangeMutex);
+        group->doneRanges.push_back(std::make_pair(begin, end));
+        num_dependents = group->fineDependents.size();
+    }
+    int count = end - begin;
+    if (num_dependents == 0) {
+        if (group->completedTasks.fetch_add(count) + count < group->numTotalTasks) return;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            finishGroup(group);
+        }
+        maybeGrow();
+        runCallbacks();
+        return;
+    }
+
+    bool last;
+    {
+        // counting the range only now keeps the launch, and with it
+        // fineDependents, from being recycled before we are through
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < num_dependents; i++) {
+            // gone if none of its tasks waited for this range
+            TaskGroupInfo* dependent = _taskGroups.find(group->fineDependents[i]);
+            if (dependent != NULL) {
+                releaseTasks(dependent, begin, end);
+            }
+        }
+        last = group->completedTasks.fetch_add(count) + count == group->numTotalTasks;
+        if (last) {
+            finishGroup(group);
+        }
+    }
+    maybeGrow();
+    if (last) {
+        runCallbacks();
+    }
+}
+
+/*
+ * Inverts a DEPEND_MAPPED launch's dependency_map, so that a finished
+ * range finds its waiters: the tasks waiting for task j of a dependency
+ * are waiters_of[waiters_begin[j]..waiters_begin[j + 1]). Inputs at or
+ * past max_inputs, the most tasks any dependency has, wait for nothing
+ * and are dropped like negative ones.
+ */
+static void invertDependencyMap(const std::function<int(int)>& map, int num_tasks, int max_inputs,
+                                std::vector<int>* waiters_begin, std::vector<int>* waiters_of) {
+    std::vector<int> inputs(num_tasks);
+    int num_inputs = 0;
+    for (int i = 0; i < num_tasks; i++) {
+        inputs[i] = map(i);
+        if (inputs[i] >= max_inputs) inputs[i] = -1;
+        num_inputs = std::max(num_inputs, inputs[i] + 1);
+    }
+    waiters_begin->assign(num_inputs + 1, 0);
+    waiters_of->resize(num_tasks);
+    for (int i = 0; i < num_tasks; i++) {
+        if (inputs[i] >= 0) (*waiters_begin)[inputs[i] + 1]++;
+    }
+    for (int j = 0; j < num_inputs; j++) {
+        (*waiters_begin)[j + 1] += (*waiters_begin)[j];
+    }
+    std::vector<int> fill(waiters_begin->begin(), waiters_begin->end() - 1);
+    for (int i = 0; i < num_tasks; i++) {
+        if (inputs[i] >= 0) (*waiters_of)[fill[inputs[i]]++] = i;
+    }
+}
+
+/*
+ * Wires up a launch whose tasks wait for individual tasks of `deps`
+ * (LaunchOptions::dependency_mode), counting for every task how many of
+ * its inputs are still missing, and queues the tasks that have none.
+ * For DEPEND_MAPPED, waiters_begin and waiters_of hold the inverted
+ * mapping and are taken over by the launch. Must be called with _mutex
+ * held.
+ */
+void TaskSystemParallelThreadPoolSleeping::addTaskDependencies(TaskGroupInfo* group,
+                                                               const std::vector<TaskGroupInfo*>& deps,
+                                                               DependencyMode mode,
+                                                               std::vector<int>& waiters_begin,
+                                                               std::vector<int>& waiters_of) {
+    int num_tasks = group->numTotalTasks;
+    group->dependencyMode = mode;
+    group->taskDepsLeft.assign(num_tasks, 0);
+    group->waitersBegin.swap(waiters_begin);
+    group->waitersOf.swap(waiters_of);
+    std::vector<int>& left = group->taskDepsLeft;
+
+    // count every input that exists, then take back the finished ones
+    for (TaskGroupInfo* dep : deps) {
+        std::lock_guard<std::mutex> lock(dep->rangeMutex);
+        dep->keepRanges.store(true);
+        // chunks that finished before keepRanges was set are not in
+        // doneRanges; wait for the whole dependency then
+        bool late = dep->completedRanges.load() != (int)dep->doneRanges.size();
+        if (late) {
+            dep->lateDependents.push_back(group->id);
+        } else {
+            dep->fineDependents.push_back(group->id);
+        }
+        const std::vector<std::pair<int, int> >& done = dep->doneRanges;
+        size_t num_done = late ? 0 : done.size();
+        if (group->dependencyMode == DEPEND_ELEMENTWISE) {
+            int shared = std::min(num_tasks, dep->numTotalTasks);
+            for (int i = 0; i < shared; i++) left[i]++;
+            for (size_t r = 0; r < num_done; r++) {
+                int end = std::min(done[r].second, num_tasks);
+                for (int i = done[r].first; i < end; i++) left[i]--;
+            }
+        } else {
+            int num_inputs = std::min((int)group->waitersBegin.size() - 1, dep->numTotalTasks);
+            for (int k = 0; k < group->waitersBegin[num_inputs]; k++) {
+                left[group->waitersOf[k]]++;
+            }
+            for (size_t r = 0; r < num_done; r++) {
+                int end = std::min(done[r].second, num_inputs);
+                for (int j = done[r].first; j < end; j++) {
+                    for (int k = group->waitersBegin[j]; k < group->waitersBegin[j + 1]; k++) {
+                        left[group->waitersOf[k]]--;
                     }
-                    _worker_cv.notify_all();
                 }
             }
-            _allTaskGroups.erase(currentTaskUnit->group->id);
-            _activeTaskGroups.fetch_sub(1);
-            if (_activeTaskGroups.load() == 0) {
-                // notify sync function
-                delete currentTaskUnit->group;
-                _sync_cv.notify_one();
+        }
+    }
+
+    int run_begin = -1;
+    for (int i = 0; i <= num_tasks; i++) {
+        bool ready = i < num_tasks && left[i] == 0;
+        if (ready && run_begin < 0) {
+            run_begin = i;
+        } else if (!ready && run_begin >= 0) {
+            pushRange(group, run_begin, i);
+            run_begin = -1;
+        }
+    }
+}
+
+/*
+ * Called when tasks [begin, end) of one of the dependencies of `group`
+ * have finished: queues the tasks of `group` that were only waiting for
+ * those. Must be called with _mutex held.
+ */
+void TaskSystemParallelThreadPoolSleeping::releaseTasks(TaskGroupInfo* group, int begin, int end) {
+    std::vector<int>& left = group->taskDepsLeft;
+    if (group->dependencyMode == DEPEND_ELEMENTWISE) {
+        end = std::min(end, group->numTotalTasks);
+        int run_begin = -1;
+        for (int i = begin; i <= end; i++) {
+            bool ready = i < end && --left[i] == 0;
+            if (ready && run_begin < 0) {
+                run_begin = i;
+            } else if (!ready && run_begin >= 0) {
+                pushRange(group, run_begin, i);
+                run_begin = -1;
             }
         }
-        delete currentTaskUnit;
-        lock.unlock();
+        return;
+    }
+
+    std::vector<int> ready;
+    int num_inputs = (int)group->waitersBegin.size() - 1;
+    for (int j = begin; j < std::min(end, num_inputs); j++) {
+        for (int k = group->waitersBegin[j]; k < group->waitersBegin[j + 1]; k++) {
+            int i = group->waitersOf[k];
+            if (--left[i] == 0) ready.push_back(i);
+        }
+    }
+    std::sort(ready.begin(), ready.end());
+    // queue runs of consecutive tasks
+    size_t first = 0;
+    for (size_t k = 1; k <= ready.size(); k++) {
+        if (k == ready.size() || ready[k] != ready[k - 1] + 1) {
+            pushRange(group, ready[first], ready[k - 1] + 1);
+            first = k;
+        }
+    }
+}
+
+/*
+ * Queues tasks [begin, end) of a launch that is released task by task,
+ * cut into chunks, and wakes a worker per chunk. Chunks are sized for the
+ * whole launch rather than for the range: ranges mostly mirror the chunks
+ * of a dependency, and cutting them up further would compound over a
+ * chain of launches.
+ */
+void TaskSystemParallelThreadPoolSleeping::pushRange(TaskGroupInfo* group, int begin, int end) {
+    int max_chunk = grainOf(group).chunkSize(group->numTotalTasks, threadsOf(group),
+                                             group->grainSize);
+    WorkerPool* pool = (group->pool == 0) ? NULL : _pools[group->pool];
+    int num_chunks = 0;
+    {
+        std::lock_guard<std::mutex> lock(pool ? pool->mutex : _rangeMutex);
+        while (begin < end) {
+            int chunk = std::min(max_chunk, end - begin);
+            TaskRangeInfo range = {group, begin, begin + chunk};
+            if (pool) {
+                pool->ranges.push_back(range);
+            } else {
+                _rangeQueue.push_back(range);
+            }
+            begin += chunk;
+            num_chunks++;
+        }
+        if (!pool) _rangeCount.fetch_add(num_chunks);
+    }
+    if (pool) {
+        wakePool(pool, num_chunks);
+    } else {
+        _parking.unpark(std::min(num_chunks, threadsOf(group)));
+        requestGrow();
+    }
+}
+
+bool TaskSystemParallelThreadPoolSleeping::popRange(TaskRangeInfo* range) {
+    if (_rangeCount.load() == 0) return false;
+    std::lock_guard<std::mutex> lock(_rangeMutex);
+    if (_rangeQueue.empty()) return false;
+    *range = _rangeQueue.front();
+    _rangeQueue.pop_front();
+    _rangeCount.fetch_sub(1);
+    return true;
+}
+
+/*
+ * Queues a launch with unclaimed tasks on the calling thread's NUMA node,
+ * which is where a released launch's inputs were just produced, and wakes
+ * up to wake_count parked workers for it. Launches directed to a pool from
+ * addPool() go to that pool's queue instead.
+ */
+void TaskSystemParallelThreadPoolSleeping::pushReady(TaskGroupInfo* group, int wake_count) {
+    if (group->pool != 0) {
+        WorkerPool* pool = _pools[group->pool];
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            pool->ready.push_back(group);
+        }
+        wakePool(pool, wake_count);
+        return;
+    }
+    bool critical_path = _criticalPath.load(std::memory_order_relaxed);
+    bool by_deadline = group->deadline != 0 && _earliestDeadline.load(std::memory_order_relaxed);
+    if (group->priority != 0 || critical_path || by_deadline) {
+        ReadyEntry entry = {group->priority, by_deadline ? group->deadline : LONG_MAX,
+                            critical_path ? group->pathLength : 0, group->seq, group};
+        std::lock_guard<std::mutex> lock(_priorityMutex);
+        _priorityQueue.push_back(entry);
+        std::push_heap(_priorityQueue.begin(), _priorityQueue.end());
+        _priorityCount.fetch_add(1);
+    } else {
+        int node = Topology::get().currentNode();
+        if (!_readyQueues[node].push(group)) {
+            std::lock_guard<std::mutex> lock(_overflowMutex);
+            _overflowQueue.push(group);
+            _overflowCount.fetch_add(1);
+        }
+    }
+    _parking.unpark(wake_count);
+    requestGrow();
+}
+
+/*
+ * Pops a launch: launches with a positive priority first (and, under
+ * SCHEDULE_EARLIEST_DEADLINE, those with a deadline), then those of the
+ * calling thread's node, then the other nodes', and launches with a
+ * negative priority last, and claims a chunk of it.
+ */
+bool TaskSystemParallelThreadPoolSleeping::popReady(TaskRangeInfo* chunk) {
+    if (_priorityCount.load() > 0 && popPriority(chunk, false)) {
+        return true;
+    }
+    TaskGroupInfo* group = NULL;
+    int node = Topology::get().currentNode();
+    for (int i = 0; i < _numNodes && group == NULL; i++) {
+        _readyQueues[(node + i) % _numNodes].pop(&group);
+    }
+    if (group == NULL && _overflowCount.load() > 0) {
+        std::lock_guard<std::mutex> lock(_overflowMutex);
+        if (!_overflowQueue.empty()) {
+            group = _overflowQueue.front();
+            _overflowQueue.pop();
+            _overflowCount.fetch_sub(1);
+        }
+    }
+    if (group != NULL) {
+        *chunk = takeChunk(group);
+        return true;
+    }
+    return _priorityCount.load() > 0 && popPriority(chunk, true);
+}
+
+/*
+ * Claims a chunk of the highest ranked launch in the priority queue.
+ * A launch keeps its one entry until its last chunk is claimed. Launches
+ * with a negative priority are only taken if below_default is set.
+ */
+bool TaskSystemParallelThreadPoolSleeping::popPriority(TaskRangeInfo* chunk, bool below_default) {
+    std::lock_guard<std::mutex> lock(_priorityMutex);
+    if (_priorityQueue.empty()) return false;
+    if (!below_default && _priorityQueue.front().priority < 0) return false;
+    *chunk = claimChunk(_priorityQueue.front().group);
+    if (chunk->end == chunk->group->numTotalTasks) {
+        std::pop_heap(_priorityQueue.begin(), _priorityQueue.end());
+        _priorityQueue.pop_back();
+        _priorityCount.fetch_sub(1);
+    }
+    return true;
+}
+
+/*
+ * SCHEDULE_CRITICAL_PATH: a launch's rank is the tasks on the longest chain
+ * of unfinished launches that starts with it, so a new dependent can only
+ * lengthen the chains of the launches it waits for, and theirs in turn.
+ * The increase is carried upstream until it no longer raises anything;
+ * launches already queued are sifted up in place. Must be called with
+ * _mutex held.
+ */
+void TaskSystemParallelThreadPoolSleeping::extendPath(TaskGroupInfo* group) {
+    std::vector<TaskGroupInfo*> stack(1, group);
+    while (!stack.empty()) {
+        TaskGroupInfo* current = stack.back();
+        stack.pop_back();
+        for (TaskID dependencyID : current->dependencies) {
+            TaskGroupInfo* dependency = _taskGroups.find(dependencyID);
+            if (dependency == NULL) continue;
+            long length = dependency->numTotalTasks + current->pathLength;
+            if (length <= dependency->pathLength) continue;
+            dependency->pathLength = length;
+            if (dependency->dependenciesLeft.load() == 0) {
+                // a prefix of a heap is a heap, so push_heap() over the
+                // entries up to this one sifts it up
+                std::lock_guard<std::mutex> lock(_priorityMutex);
+                for (size_t i = 0; i < _priorityQueue.size(); i++) {
+                    if (_priorityQueue[i].group != dependency) continue;
+                    _priorityQueue[i].pathLength = length;
+                    std::push_heap(_priorityQueue.begin(), _priorityQueue.begin() + i + 1);
+                    break;
+                }
+            }
+            stack.push_back(dependency);
+        }
+    }
+}
+
+bool TaskSystemParallelThreadPoolSleeping::hasReady() {
+    for (int i = 0; i < _numNodes; i++) {
+        if (!_readyQueues[i].empty()) return true;
+    }
+    return _overflowCount.load() > 0 || _priorityCount.load() > 0 || _rangeCount.load() > 0;
+}
+
+/*
+ * Makes a launch whose dependencies are all satisfied runnable. Must be
+ * called with _mutex held.
+ */
+void TaskSystemParallelThreadPoolSleeping::releaseGroup(TaskGroupInfo* group) {
+    if (group->numTotalTasks == 0 || group->cancelled.load()) {
+        group->runnable->skipTasks(0, group->numTotalTasks, group->numTotalTasks);
+        // none of its ranges will come through completeRange()
+        for (TaskID dependentID : group->fineDependents) {
+            TaskGroupInfo* dependent = _taskGroups.find(dependentID);
+            if (dependent != NULL) {
+                releaseTasks(dependent, 0, group->numTotalTasks);
+            }
+        }
+        finishGroup(group);
+        return;
+    }
+    // wake one worker per chunk the launch is likely to be split into
+    int first_chunk = grainOf(group).chunkSize(group->numTotalTasks, threadsOf(group),
+                                               group->grainSize);
+    int num_chunks = (group->numTotalTasks + first_chunk - 1) / first_chunk;
+    pushReady(group, std::min(num_chunks, threadsOf(group)));
+}
+
+/*
+ * Called once every task of a launch has run: releases dependents and
+ * retires the launch. Must be called with _mutex held.
+ */
+void TaskSystemParallelThreadPoolSleeping::finishGroup(TaskGroupInfo* group) {
+    if (group->deadline != 0 && !group->cancelled.load() && IdlePolicy::nowNs() > group->deadline) {
+        _deadlineMisses.fetch_add(1);
+    }
+    // a cancelled launch's dependents were cancelled along with it, by
+    // cancel() or when they were submitted
+    for (TaskID dependentID : group->dependents) {
+        TaskGroupInfo* dependentTaskGroup = _taskGroups.find(dependentID);
+        if (dependentTaskGroup->dependenciesLeft.fetch_sub(1) == 1) {
+            releaseGroup(dependentTaskGroup);
+        }
+    }
+    for (TaskID dependentID : group->lateDependents) {
+        TaskGroupInfo* dependent = _taskGroups.find(dependentID);
+        if (dependent != NULL) {
+            releaseTasks(dependent, 0, group->numTotalTasks);
+        }
+    }
+    _taskGroups.release(group);
+    _finishEpoch.fetch_add(1);
+    if (group->waiters > 0) {
+        group->doneCv.notify_all();
+    }
+    if (_anyWaiters > 0) {
+        _any_cv.notify_all();
+    }
+    if (!group->callbacks.empty()) {
+        // stays active for sync() until runCallbacks() has run them
+        _readyCallbacks.insert(_readyCallbacks.end(),
+                               group->callbacks.begin(), group->callbacks.end());
+        group->callbacks.clear();
+        _callbackGroups.fetch_add(1);
+        return;
+    }
+    if (_activeTaskGroups.fetch_sub(1) == 1) {
+        // notify sync function
+        _sync_cv.notify_one();
     }
 }
 
 TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                                     const std::vector<TaskID>& deps) {
+    return runAsyncWithOptions(runnable, num_total_tasks, deps, LaunchOptions());
+}
+
+/*
+ * Claims the table slot for a new launch and resets it; the caller wires
+ * up its dependencies. Must be called with _mutex held.
+ */
+TaskGroupInfo* TaskSystemParallelThreadPoolSleeping::newGroup(IRunnable* runnable,
+                                                              int num_total_tasks,
+                                                              const LaunchOptions& options) {
+    TaskGroupInfo* group = _taskGroups.insert();
+    group->seq = _numSubmitted++;
+    group->runnable = runnable;
+    group->numTotalTasks = num_total_tasks;
+    group->grainSize = options.grain_size;
+    group->nextTask.store(0);
+    group->completedTasks.store(0);
+    group->dependents.clear(); // keeps capacity from earlier launches
+    group->cancelled.store(false);
+    group->priority = options.priority;
+    group->pool = (options.pool > 0 && options.pool < _numPools) ? options.pool : 0;
+    group->deadline = (options.deadline_ns > 0) ? IdlePolicy::nowNs() + options.deadline_ns : 0;
+    group->pathLength = num_total_tasks;
+    group->dependencies.clear();
+    group->completedRanges.store(0);
+    group->keepRanges.store(false);
+    group->doneRanges.clear();
+    group->fineDependents.clear();
+    group->lateDependents.clear();
+    group->dependencyMode = DEPEND_ALL;
+    group->taskDepsLeft.clear();
+    return group;
+}
 
+TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithOptions(IRunnable* runnable, int num_total_tasks,
+                                                               const std::vector<TaskID>& deps,
+                                                               const LaunchOptions& options) {
+    // without a map there is nothing finer to wait for than all tasks
+    DependencyMode mode = options.dependency_mode;
+    if (mode == DEPEND_MAPPED && !options.dependency_map) {
+        mode = DEPEND_ALL;
+    }
+    bool per_task = mode != DEPEND_ALL && num_total_tasks > 0 && !deps.empty();
+    // the map is user code, so it runs outside the lock
+    std::vector<int> waiters_begin;
+    std::vector<int> waiters_of;
+    if (per_task && mode == DEPEND_MAPPED) {
+        // a dependency that finishes before the launch is wired up only
+        // leaves the bound larger than it needs to be
+        int max_inputs = 0;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (TaskID dependentID : deps) {
+                TaskGroupInfo* dependentTaskGroup = _taskGroups.find(dependentID);
+                if (dependentTaskGroup != NULL) {
+                    max_inputs = std::max(max_inputs, dependentTaskGroup->numTotalTasks);
+                }
+            }
+        }
+        invertDependencyMap(options.dependency_map, num_total_tasks, max_inputs,
+                            &waiters_begin, &waiters_of);
+    }
 
-    //
-    // TODO: CS149 students will implement this method in Part B.
-    //
     std::unique_lock<std::mutex> lock(_mutex);
-    TaskGroupInfo* newTaskGroup = new TaskGroupInfo;
-    newTaskGroup->id = _nextTaskGroupId.fetch_add(1);
-    newTaskGroup->runnable = runnable;
-    newTaskGroup->numTotalTasks = num_total_tasks;
-    newTaskGroup->completedTasks.store(0);
-    newTaskGroup->dependenciesLeft.store(deps.size());
-    newTaskGroup->dependents = {};
-    
-    // do something if it has dependencies
+    TaskGroupInfo* newTaskGroup = newGroup(runnable, num_total_tasks, options);
+    TaskID id = newTaskGroup->id;
+    _activeTaskGroups.fetch_add(1);
+
+    // only wait on dependencies that have not finished yet
+    bool critical_path = _criticalPath.load();
+    std::vector<TaskGroupInfo*> task_deps;
+    int pending = 0;
     for (TaskID dependentID : deps) {
-        TaskGroupInfo* dependentTaskGroup = _allTaskGroups[dependentID];
-        dependentTaskGroup->dependents.push_back(newTaskGroup->id);
+        TaskGroupInfo* dependentTaskGroup = _taskGroups.find(dependentID);
+        if (dependentTaskGroup == NULL) continue;
+        if (dependentTaskGroup->cancelled.load()) {
+            // cancel() has already walked past this launch, so its tasks
+            // are skipped as the dependency's skipped ranges release them
+            newTaskGroup->cancelled.store(true);
+        }
+        if (critical_path) {
+            newTaskGroup->dependencies.push_back(dependentID);
+        }
+        if (per_task) {
+            task_deps.push_back(dependentTaskGroup);
+            continue;
+        }
+        dependentTaskGroup->dependents.push_back(id);
+        pending++;
+    }
+    newTaskGroup->dependenciesLeft.store(pending);
+    if (critical_path) {
+        extendPath(newTaskGroup);
     }
-    if (deps.size() == 0) {
-        for (int i = 0; i < num_total_tasks; i++) {
-            _taskQueue.push(new TaskUnitInfo{i, runnable, newTaskGroup});
+    if (!task_deps.empty()) {
+        // released range by range as its inputs finish
+        addTaskDependencies(newTaskGroup, task_deps, mode, waiters_begin, waiters_of);
+    } else if (pending == 0) {
+        // the whole launch is queued as one descriptor
+        releaseGroup(newTaskGroup);
+    }
+
+    TaskScope* scope = TaskScope::of(this);
+    if (scope != NULL) {
+        scope->children.push_back(id);
+    }
+
+    lock.unlock();
+    maybeGrow();
+    runCallbacks();
+    return id;
+}
+
+/*
+ * Instantiates the whole graph under one lock: the precompiled
+ * dependents only need translating from node indices to the new ids,
+ * and the slots' vectors keep their capacity from earlier launches.
+ * Apart from that only the counters are reset before the roots are
+ * released. Replayed launches always wait for their dependencies as a
+ * whole, whatever their dependency_mode.
+ */
+void TaskSystemParallelThreadPoolSleeping::replay(const TaskGraph& graph) {
+    int num_nodes = graph.size();
+    if (num_nodes == 0) return;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::vector<TaskGroupInfo*> groups(num_nodes);
+    for (int i = 0; i < num_nodes; i++) {
+        const TaskGraph::Node& node = graph.node(i);
+        groups[i] = newGroup(node.runnable, node.numTotalTasks, node.options);
+        groups[i]->dependenciesLeft.store(node.dependencies.size());
+        groups[i]->pathLength = node.pathLength;
+        if (_criticalPath.load()) {
+            // so that launches submitted later can lengthen these chains
+            for (int dependency : node.dependencies) {
+                groups[i]->dependencies.push_back(groups[dependency]->id);
+            }
+        }
+    }
+    for (int i = 0; i < num_nodes; i++) {
+        for (int dependent : graph.node(i).dependents) {
+            groups[i]->dependents.push_back(groups[dependent]->id);
+        }
+    }
+    _activeTaskGroups.fetch_add(num_nodes);
+    for (int root : graph.roots()) {
+        releaseGroup(groups[root]);
+    }
+
+    TaskScope* scope = TaskScope::of(this);
+    if (scope != NULL) {
+        for (int i = 0; i < num_nodes; i++) {
+            scope->children.push_back(groups[i]->id);
         }
-        _worker_cv.notify_all();
     }
-    _allTaskGroups[newTaskGroup->id] = newTaskGroup;
-    _activeTaskGroups.fetch_add(1);
 
     lock.unlock();
-    return newTaskGroup->id;
+    maybeGrow();
+    runCallbacks();
 }
 
 void TaskSystemParallelThreadPoolSleeping::sync() {
+    TaskScope* scope = TaskScope::of(this);
+    if (scope != NULL) {
+        // nested launch: wait for this task's children only, helping
+        // with other work meanwhile
+        std::vector<TaskID> children;
+        children.swap(scope->children);
+        waitAll(children);
+        return;
+    }
+
+    // help run ready launches instead of blocking while the pool is busy;
+    // park only once nothing has been queued for a while
+    TaskRangeInfo range;
+    while (_activeTaskGroups.load() > 0) {
+        if (popRange(&range) || popReady(&range)) {
+            runRange(range);
+            continue;
+        }
+        if (_idle.spinWait([this] { return !_activeTaskGroups.load() || hasReady(); })) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _sync_cv.wait(lock, [this]{
+            return !_activeTaskGroups.load();
+        });
+    }
+    return;
+}
+
+/*
+ * Takes effect for launches that become ready from now on; launches
+ * submitted under SCHEDULE_FIFO do not have their paths computed.
+ */
+bool TaskSystemParallelThreadPoolSleeping::setSchedulingPolicy(SchedulingPolicy policy) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _criticalPath.store(policy == SCHEDULE_CRITICAL_PATH);
+    _earliestDeadline.store(policy == SCHEDULE_EARLIEST_DEADLINE);
+    return true;
+}
+
+long TaskSystemParallelThreadPoolSleeping::deadlineMisses() {
+    return _deadlineMisses.load();
+}
+
+bool TaskSystemParallelThreadPoolSleeping::isDone(TaskID id) {
+    if (id < 0) return true;
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _taskGroups.find(id) == NULL;
+}
+
+/*
+ * Waits on the launch's own condition variable, so only the threads
+ * waiting for this launch wake up when it finishes.
+ */
+void TaskSystemParallelThreadPoolSleeping::wait(TaskID id) {
+    while (true) {
+        unsigned int epoch = _finishEpoch.load();
+        if (isDone(id)) return;
+        if (helpWhileWaiting(epoch)) continue;
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        TaskGroupInfo* group = _taskGroups.find(id);
+        if (group == NULL) return;
+        // the slot may be reused for a later launch by the time we wake,
+        // so the predicate checks the id, not the object
+        group->waiters++;
+        group->doneCv.wait(lock, [this, id] {
+            return _taskGroups.find(id) == NULL;
+        });
+        group->waiters--;
+        return;
+    }
+}
+
+TaskID TaskSystemParallelThreadPoolSleeping::waitAny(const std::vector<TaskID>& ids) {
+    if (ids.empty()) return -1;
+    while (true) {
+        unsigned int epoch = _finishEpoch.load();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            TaskID done = findDone(ids);
+            if (done != -1) return done;
+        }
+        if (helpWhileWaiting(epoch)) continue;
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _anyWaiters++;
+        _any_cv.wait(lock, [this, &ids] {
+            return findDone(ids) != -1;
+        });
+        _anyWaiters--;
+        return findDone(ids);
+    }
+}
+
+/*
+ * Marks the launch and everything downstream of it as cancelled. Ready
+ * launches skip their remaining tasks when they are next popped; the
+ * others skip all of theirs once released, which still waits for their
+ * dependencies. Launches that come to depend on a cancelled one before it
+ * finishes inherit the flag when they are submitted, in
+ * runAsyncWithOptions().
+ */
+bool TaskSystemParallelThreadPoolSleeping::cancel(TaskID id) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    TaskGroupInfo* group = (id < 0) ? NULL : _taskGroups.find(id);
+    if (group == NULL) return false;
+
+    std::vector<TaskGroupInfo*> stack(1, group);
+    group->cancelled.store(true);
+    while (!stack.empty()) {
+        TaskGroupInfo* current = stack.back();
+        stack.pop_back();
+        for (TaskID dependentID : current->dependents) {
+            TaskGroupInfo* dependent = _taskGroups.find(dependentID);
+            if (!dependent->cancelled.load()) {
+                dependent->cancelled.store(true);
+                stack.push_back(dependent);
+            }
+        }
+        for (const std::vector<TaskID>* fine : {&current->fineDependents, &current->lateDependents}) {
+            for (TaskID dependentID : *fine) {
+                TaskGroupInfo* dependent = _taskGroups.find(dependentID);
+                if (dependent != NULL && !dependent->cancelled.load()) {
+                    dependent->cancelled.store(true);
+                    stack.push_back(dependent);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void TaskSystemParallelThreadPoolSleeping::onComplete(TaskID id,
+                                                      const std::function<void()>& fn) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        TaskGroupInfo* group = (id < 0) ? NULL : _taskGroups.find(id);
+        if (group != NULL) {
+            group->callbacks.push_back(fn);
+            return;
+        }
+    }
+    fn();
+}
+
+/*
+ * Runs the callbacks of launches that finished on this thread, outside of
+ * _mutex since they may launch more work, and then retires those launches.
+ */
+void TaskSystemParallelThreadPoolSleeping::runCallbacks() {
+    if (_callbackGroups.load() == 0) return;
+    std::vector<std::function<void()> > callbacks;
+    int groups;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        callbacks.swap(_readyCallbacks);
+        groups = _callbackGroups.exchange(0);
+    }
+    for (size_t i = 0; i < callbacks.size(); i++) {
+        callbacks[i]();
+    }
+    if (groups == 0) return;
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_activeTaskGroups.fetch_sub(groups) == groups) {
+        _sync_cv.notify_one();
+    }
+}
+
+/*
+ * Called by a thread waiting on specific launches: runs one ready chunk,
+ * or spins until work shows up or some launch finishes after `epoch`.
+ * Returns false if the caller should block instead. Only threads inside a
+ * task help; a thread outside the pool could pick up an unrelated chunk
+ * that runs for much longer than what it waits for, e.g. another
+ * TaskStream's.
+ */
+bool TaskSystemParallelThreadPoolSleeping::helpWhileWaiting(unsigned int epoch) {
+    if (TaskScope::of(this) == NULL) {
+        return _idle.spinWait([this, epoch] {
+            return _finishEpoch.load() != epoch;
+        });
+    }
+    TaskRangeInfo range;
+    if (popRange(&range) || popReady(&range)) {
+        runRange(range);
+        return true;
+    }
+    return _idle.spinWait([this, epoch] {
+        return hasReady() || _finishEpoch.load() != epoch;
+    });
+}
+
+/*
+ * Returns the first of ids whose launch is done, or -1. Must be called
+ * with _mutex held.
+ */
+TaskID TaskSystemParallelThreadPoolSleeping::findDone(const std::vector<TaskID>& ids) {
+    for (TaskID id : ids) {
+        if (id < 0 || _taskGroups.find(id) == NULL) return id;
+    }
+    return -1;
+}
+
+/*
+ * ================================================================
+ * Parallel Thread Pool Work Stealing Task System Implementation
+ * ================================================================
+ */
+
+int TaskSystemParallelThreadPoolStealing::numWorkers() {
+    return _numThreads;
+}
+
+const char* TaskSystemParallelThreadPoolStealing::name() {
+    return "Parallel + Thread Pool + Steal";
+}
+
+TaskSystemParallelThreadPoolStealing::TaskSystemParallelThreadPoolStealing(int num_threads,
+                                                                           PlacementPolicy placement)
+    : ITaskSystem(num_threads), _parking(num_threads) {
+    _numThreads = num_threads;
+    _deques = new WorkStealingDeque<TaskRangeInfo*>[num_threads];
+    _injectCount.store(0);
+    _activeTaskGroups.store(0);
+    _workEpoch.store(0);
+    _finishEpoch.store(0);
+    _waiters = 0;
+    _isDone.store(false);
+    threads = new std::thread[num_threads];
+    for (int i = 0; i < num_threads; i++) {
+        threads[i] = std::thread(&TaskSystemParallelThreadPoolStealing::threadLoop, this, i);
+    }
+    Topology::pinThreads(threads, num_threads, placement);
+}
+
+TaskSystemParallelThreadPoolStealing::~TaskSystemParallelThreadPoolStealing() {
+    _isDone.store(true);
+    _parking.unparkAll();
+    for (int i = 0; i < _numThreads; i++) {
+        threads[i].join();
+    }
+    delete[] threads;
+    delete[] _deques;
+}
+
+void TaskSystemParallelThreadPoolStealing::run(IRunnable* runnable, int num_total_tasks) {
+    runAsyncWithDeps(runnable, num_total_tasks, {});
+    sync();
+}
+
+/*
+ * Called once per published range. A range can only keep one thief busy
+ * (it splits further once stolen, waking the next), so wake one worker.
+ */
+void TaskSystemParallelThreadPoolStealing::notifyWork() {
+    _workEpoch.fetch_add(1);
+    _parking.unpark(1);
+}
+
+/*
+ * worker_id is -1 for a thread outside the pool that helps from sync(); it
+ * has no deque of its own and only takes injected or stolen ranges.
+ */
+bool TaskSystemParallelThreadPoolStealing::findWork(int worker_id, unsigned int* seed,
+                                                    TaskRangeInfo** range) {
+    if (worker_id >= 0 && _deques[worker_id].pop(range)) {
+        return true;
+    }
+
+    if (_injectCount.load() > 0) {
+        std::lock_guard<std::mutex> lock(_injectMutex);
+        if (!_injectQueue.empty()) {
+            *range = _injectQueue.front();
+            _injectQueue.pop();
+            _injectCount.fetch_sub(1);
+            return true;
+        }
+    }
 
-    //
-    // TODO: CS149 students will modify the implementation of this method in Part B.
-    //
+    // xorshift to pick a random first victim, then sweep the others
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    int start = *seed % _numThreads;
+    for (int i = 0; i < _numThreads; i++) {
+        int victim = (start + i) % _numThreads;
+        if (victim == worker_id || _deques[victim].empty()) continue;
+        if (_deques[victim].steal(range)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskSystemParallelThreadPoolStealing::executeRange(int worker_id, TaskRangeInfo* range) {
+    TaskGroupInfo* group = range->group;
+    int grain = std::max(1, group->numTotalTasks / (4 * _numThreads));
+
+    // split lazily: keep the left half, expose the right half to thieves
+    while (range->end - range->begin > grain) {
+        int mid = range->begin + (range->end - range->begin) / 2;
+        pushRange(worker_id, new TaskRangeInfo{group, mid, range->end});
+        range->end = mid;
+    }
+
+    {
+        TaskScope scope(this);
+        group->runnable->runTasks(range->begin, range->end, group->numTotalTasks);
+    }
+
+    int count = range->end - range->begin;
+    delete range;
+    if (group->completedTasks.fetch_add(count) + count == group->numTotalTasks) {
+        completeGroup(worker_id, group);
+    }
+}
+
+void TaskSystemParallelThreadPoolStealing::scheduleGroup(int worker_id, TaskGroupInfo* group) {
+    pushRange(worker_id, new TaskRangeInfo{group, 0, group->numTotalTasks});
+}
+
+/*
+ * Publishes a range: workers push onto their own deque, other threads go
+ * through the inject queue.
+ */
+void TaskSystemParallelThreadPoolStealing::pushRange(int worker_id, TaskRangeInfo* range) {
+    if (worker_id >= 0) {
+        _deques[worker_id].push(range);
+    } else {
+        std::lock_guard<std::mutex> lock(_injectMutex);
+        _injectQueue.push(range);
+        _injectCount.fetch_add(1);
+    }
+    notifyWork();
+}
+
+/*
+ * Called once every task of a launch has run: releases dependents and
+ * frees the launch's slot, after which its id reads as finished.
+ */
+void TaskSystemParallelThreadPoolStealing::completeGroup(int worker_id, TaskGroupInfo* group) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (TaskID dependentID : group->dependents) {
+        TaskGroupInfo* dependentTaskGroup = _taskGroups.find(dependentID);
+        if (dependentTaskGroup->dependenciesLeft.fetch_sub(1) == 1) {
+            scheduleGroup(worker_id, dependentTaskGroup);
+        }
+    }
+    _taskGroups.release(group);
+    _finishEpoch.fetch_add(1);
+    if (_waiters > 0) {
+        _finish_cv.notify_all();
+    }
+    if (_activeTaskGroups.fetch_sub(1) == 1) {
+        _sync_cv.notify_all();
+    }
+}
+
+void TaskSystemParallelThreadPoolStealing::threadLoop(int worker_id) {
+    registerWorker(worker_id);
+    unsigned int seed = 2463534242u + worker_id;
+    TaskRangeInfo* range;
+    while (!_isDone.load()) {
+        unsigned int epoch = _workEpoch.load();
+        if (findWork(worker_id, &seed, &range)) {
+            executeRange(worker_id, range);
+            continue;
+        }
+
+        // nothing to run: spin, then sleep until someone publishes new work
+        long idle_start = IdlePolicy::nowNs();
+        auto published = [this, epoch] {
+            return _isDone.load() || _workEpoch.load() != epoch;
+        };
+        if (!_idle.spinWait(published)) {
+            _parking.park(worker_id, published);
+        }
+        _idle.recordIdle(IdlePolicy::nowNs() - idle_start);
+    }
+}
+
+TaskID TaskSystemParallelThreadPoolStealing::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                              const std::vector<TaskID>& deps) {
     std::unique_lock<std::mutex> lock(_mutex);
-    _sync_cv.wait(lock, [this]{
-        return !_activeTaskGroups.load();
+    TaskGroupInfo* newTaskGroup = _taskGroups.insert();
+    TaskID id = newTaskGroup->id;
+    newTaskGroup->runnable = runnable;
+    newTaskGroup->numTotalTasks = num_total_tasks;
+    newTaskGroup->completedTasks.store(0);
+    newTaskGroup->dependents.clear(); // keeps capacity from earlier launches
+    _activeTaskGroups.fetch_add(1);
+
+    // only wait on dependencies that have not finished yet; a launch
+    // that is still in the table will release us from completeGroup()
+    int pending = 0;
+    for (TaskID dependentID : deps) {
+        TaskGroupInfo* dependentTaskGroup = (dependentID < 0) ? NULL : _taskGroups.find(dependentID);
+        if (dependentTaskGroup == NULL) continue;
+        dependentTaskGroup->dependents.push_back(id);
+        pending++;
+    }
+    newTaskGroup->dependenciesLeft.store(pending);
+
+    // a launch from inside a task goes onto the worker's own deque, next
+    // to the work it was forked from
+    if (pending == 0) {
+        scheduleGroup(workerIndex(), newTaskGroup);
+    }
+
+    TaskScope* scope = TaskScope::of(this);
+    if (scope != NULL) {
+        scope->children.push_back(id);
+    }
+    return id;
+}
+
+void TaskSystemParallelThreadPoolStealing::sync() {
+    TaskScope* scope = TaskScope::of(this);
+    if (scope != NULL) {
+        std::vector<TaskID> children;
+        children.swap(scope->children);
+        waitForChildren(children);
+        return;
+    }
+
+    // help run ranges while launches are pending; park only once nothing
+    // has been published for a while
+    unsigned int seed = 88675123u;
+    TaskRangeInfo* range;
+    while (_activeTaskGroups.load() > 0) {
+        unsigned int epoch = _workEpoch.load();
+        if (findWork(-1, &seed, &range)) {
+            executeRange(-1, range);
+            continue;
+        }
+        if (!_idle.spinWait([this, epoch] {
+                return _activeTaskGroups.load() == 0 || _workEpoch.load() != epoch;
+            })) {
+            break;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _sync_cv.wait(lock, [this] {
+        return _activeTaskGroups.load() == 0;
     });
-    lock.unlock();
-    return;
+}
+
+/*
+ * sync() from inside a task: runs ranges, the children's or anyone
+ * else's, until the given launches are done. Never blocks, because the
+ * calling thread is the only one that can finish the task it is in; it
+ * yields instead once there is nothing to steal.
+ */
+void TaskSystemParallelThreadPoolStealing::waitForChildren(const std::vector<TaskID>& children) {
+    int worker_id = workerIndex();
+    unsigned int seed = 88675123u + worker_id;
+    TaskRangeInfo* range;
+    for (TaskID id : children) {
+        while (true) {
+            unsigned int finish_epoch = _finishEpoch.load();
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_taskGroups.find(id) == NULL) break;
+            }
+            unsigned int epoch = _workEpoch.load();
+            if (findWork(worker_id, &seed, &range)) {
+                executeRange(worker_id, range);
+                continue;
+            }
+            if (!_idle.spinWait([this, epoch, finish_epoch] {
+                    return _workEpoch.load() != epoch || _finishEpoch.load() != finish_epoch;
+                })) {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+/*
+ * Inside a task this helps like sync() does. Other threads leave the work
+ * to the pool, which keeps them from stealing an unrelated range that
+ * runs for longer than the launch they wait for, and block once spinning
+ * does not pay off.
+ */
+void TaskSystemParallelThreadPoolStealing::wait(TaskID id) {
+    if (TaskScope::of(this) != NULL) {
+        waitForChildren(std::vector<TaskID>(1, id));
+        return;
+    }
+
+    while (true) {
+        unsigned int finish_epoch = _finishEpoch.load();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (id < 0 || _taskGroups.find(id) == NULL) return;
+        }
+        if (_idle.spinWait([this, finish_epoch] {
+                return _finishEpoch.load() != finish_epoch;
+            })) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _waiters++;
+        _finish_cv.wait(lock, [this, id] {
+            return _taskGroups.find(id) == NULL;
+        });
+        _waiters--;
+        return;
+    }
 }
@@ -4,26 +4,141 @@
 #include "itasksys.h"
 #include <mutex>
 #include <queue>
+#include <deque>
 #include <atomic>
 #include <thread>
 #include <condition_variable>
-#include <map>
+#include <climits>
 #include <iostream>
+#include <string>
+#include "WorkStealingDeque.h"
+#include "AdaptiveGrain.h"
+#include "MPMCQueue.h"
+#include "IdlePolicy.h"
+#include "ParkingLot.h"
+#include "Topology.h"
+#include "TaskGraph.h"
 
 typedef struct _TaskGroupInfo {
     TaskID id; // group
+    unsigned long seq; // submission order, for ties in the ready queue
     IRunnable* runnable;
     int numTotalTasks;
+    int grainSize; // LaunchOptions::grain_size, 0 if adaptive
+    std::atomic<int> nextTask; // next task id to hand out to a worker
     std::atomic<int> completedTasks;
     std::atomic<int> dependenciesLeft;
     std::vector<TaskID> dependents;
+    int waiters; // threads blocked in wait() on this object, across ids
+    std::condition_variable doneCv; // signalled when the launch finishes
+    std::vector<std::function<void()> > callbacks; // from onComplete()
+    int priority; // LaunchOptions::priority
+    int pool; // LaunchOptions::pool, 0 if it named no valid pool
+    long deadline; // absolute, on the IdlePolicy::nowNs() clock; 0 if none
+    // under SCHEDULE_CRITICAL_PATH, the tasks on the longest chain of
+    // unfinished launches that starts with this one, its own included;
+    // raised as dependents are submitted
+    long pathLength;
+    std::vector<TaskID> dependencies; // under SCHEDULE_CRITICAL_PATH, the launches it waited for
+    std::atomic<bool> cancelled; // unstarted tasks are skipped
+    // task-level dependencies (LaunchOptions::dependency_mode)
+    std::atomic<int> completedRanges; // chunks run or skipped so far
+    std::atomic<bool> keepRanges; // set by the first fine dependent
+    std::mutex rangeMutex;
+    std::vector<std::pair<int, int> > doneRanges; // finished chunks once keepRanges is set; guarded by rangeMutex
+    std::vector<TaskID> fineDependents; // guarded by rangeMutex
+    std::vector<TaskID> lateDependents; // fine dependents that came after unrecorded chunks
+    DependencyMode dependencyMode;
+    std::vector<int> taskDepsLeft; // per task, empty unless released task by task
+    std::vector<int> waitersBegin; // DEPEND_MAPPED: tasks waiting for task j are
+    std::vector<int> waitersOf;    // waitersOf[waitersBegin[j]..waitersBegin[j + 1])
 } TaskGroupInfo;
 
-typedef struct _TaskUnitInfo {
-    TaskID id; // single task
-    IRunnable* runnable;
-    TaskGroupInfo* group; // used when task group end
-} TaskUnitInfo;
+/*
+ * TaskGroupTable: maps the TaskIDs of unfinished launches to their
+ * TaskGroupInfo in O(1). A TaskID names a slot and the generation of that
+ * slot it was issued in; a slot's generation is bumped whenever its
+ * launch finishes, so the ids of finished launches no longer match and
+ * are recognized without any per-id record. Free slots are reused in
+ * FIFO order, and the table only doubles when every slot is taken, so
+ * memory is bounded by the peak number of launches in flight, however
+ * long a single launch stays alive. TaskGroupInfo objects are allocated
+ * in blocks and never move, so pointers to them stay valid across a
+ * resize. Not thread-safe.
+ *
+ * At most 2^kIndexBits launches can be in flight. An id is recognized as
+ * finished until its slot has been reused kGenerations times, which with
+ * FIFO reuse of at least 1024 slots is over two million launches later.
+ */
+class TaskGroupTable {
+    public:
+        TaskGroupTable(int log_capacity = 10);
+        ~TaskGroupTable();
+        // Claims a free slot and gives its group a fresh id. The caller
+        // resets the group's other fields.
+        TaskGroupInfo* insert();
+        // Returns the group for id, or NULL if that launch has finished.
+        TaskGroupInfo* find(TaskID id);
+        // Frees the group's slot for reuse.
+        void release(TaskGroupInfo* group);
+    private:
+        static const int kIndexBits = 20;
+        static const int kIndexMask = (1 << kIndexBits) - 1;
+        static const int kGenerations = 1 << (31 - kIndexBits); // ids stay positive
+        std::vector<TaskGroupInfo*> _slots;
+        std::vector<int> _generations; // per slot
+        std::deque<int> _free; // indices of free slots, oldest first
+        std::vector<TaskGroupInfo*> _blocks;
+        void grow();
+};
+
+typedef struct _TaskRangeInfo {
+    TaskGroupInfo* group;
+    int begin; // first task id of the range
+    int end;   // one past the last task id
+} TaskRangeInfo;
+
+/*
+ * A launch in the priority-ordered ready queue, ranked by the priority
+ * and deadline it had when it was queued and by its critical path, which
+ * extendPath() raises in place; ties go to the older launch. Entries
+ * without a deadline, and all entries unless
+ * SCHEDULE_EARLIEST_DEADLINE is on, have LONG_MAX as their deadline.
+ */
+typedef struct _ReadyEntry {
+    int priority;
+    long deadline;
+    long pathLength;
+    unsigned long seq; // TaskGroupInfo::seq
+    TaskGroupInfo* group;
+
+    // ranks below other, as std::push_heap() expects
+    bool operator<(const _ReadyEntry& other) const {
+        if (priority != other.priority) return priority < other.priority;
+        if (deadline != other.deadline) return deadline > other.deadline;
+        if (pathLength != other.pathLength) return pathLength < other.pathLength;
+        return seq > other.seq;
+    }
+} ReadyEntry;
+
+/*
+ * WorkerPool: an extra set of workers of the sleeping pool, added with
+ * addPool(). Launches directed to it are queued here rather than in the
+ * main ready queues and only run on its threads. Its queues are plain
+ * FIFOs: priorities and SCHEDULE_CRITICAL_PATH order the default pool
+ * only. Task durations are measured separately, so that long blocking
+ * tasks do not inflate the chunk sizes of the default pool.
+ */
+typedef struct _WorkerPool {
+    std::string name;
+    int numThreads;
+    std::thread* threads;
+    std::mutex mutex; // guards the queues
+    std::condition_variable cv; // signalled when work is queued
+    std::deque<TaskGroupInfo*> ready;
+    std::deque<TaskRangeInfo> ranges;
+    AdaptiveGrain grain;
+} WorkerPool;
 
 /*
  * TaskSystemSerial: This class is the student's implementation of a
@@ -66,7 +181,8 @@ class TaskSystemParallelSpawn: public ITaskSystem {
  */
 class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSpinning(int num_threads);
+        TaskSystemParallelThreadPoolSpinning(int num_threads,
+                                             PlacementPolicy placement = PLACEMENT_NONE);
         ~TaskSystemParallelThreadPoolSpinning();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
@@ -80,28 +196,177 @@ class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
  * optimized implementation of a parallel task execution engine that uses
  * a thread pool. See definition of ITaskSystem in
  * itasksys.h for documentation of the ITaskSystem interface.
+ *
+ * Constructed with a minimum and a maximum thread count, the pool is
+ * elastic: it starts min_threads workers, adds one whenever work is
+ * queued while no worker is idle, at most every kGrowIntervalNs, and
+ * retires workers beyond the minimum after kRetireAfterNs parked.
  */
 class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSleeping(int num_threads);
+        TaskSystemParallelThreadPoolSleeping(int num_threads,
+                                             PlacementPolicy placement = PLACEMENT_NONE);
+        TaskSystemParallelThreadPoolSleeping(int min_threads, int max_threads,
+                                             PlacementPolicy placement = PLACEMENT_NONE);
         ~TaskSystemParallelThreadPoolSleeping();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps);
+        void runWithOptions(IRunnable* runnable, int num_total_tasks,
+                            const LaunchOptions& options);
+        TaskID runAsyncWithOptions(IRunnable* runnable, int num_total_tasks,
+                                   const std::vector<TaskID>& deps,
+                                   const LaunchOptions& options);
+        void sync();
+        void wait(TaskID id);
+        TaskID waitAny(const std::vector<TaskID>& ids);
+        bool isDone(TaskID id);
+        bool cancel(TaskID id);
+        void onComplete(TaskID id, const std::function<void()>& fn);
+        bool setSchedulingPolicy(SchedulingPolicy policy);
+        long deadlineMisses();
+        void replay(const TaskGraph& graph);
+        int addPool(const char* name, int num_threads);
+        int findPool(const char* name);
+        int numWorkers();
+        // workers currently running; between min_threads and max_threads
+        int numLiveWorkers();
+    private:
+        static const int kMaxPools = 16;
+        static const long kGrowIntervalNs = 200000;
+        static const long kRetireAfterNs = 100000000;
+        int _numThreads; // maximum; the size of threads
+        std::thread* threads;
+        // elastic mode: workers run in slots with _slotLive set, between
+        // _minThreads and _numThreads of them
+        int _minThreads;
+        std::atomic<int> _liveThreads;
+        std::atomic<int> _idleThreads; // live workers spinning or parked
+        std::vector<bool> _slotLive; // guarded by _elasticMutex
+        std::mutex _elasticMutex;
+        std::atomic<long> _lastGrowNs;
+        std::atomic<bool> _growRequested; // by requestGrow(), for maybeGrow()
+        std::vector<int> _cpus; // per slot, empty if workers are not pinned
+        // _pools[1.._numPools - 1] are the ones from addPool(); guarded by
+        // _mutex, but a launch's pool can be read without it
+        WorkerPool* _pools[kMaxPools];
+        int _numPools;
+        std::atomic<int> _numWorkers; // across all pools
+        TaskGroupTable _taskGroups;
+        // launches with unclaimed tasks, one queue per NUMA node
+        MPMCQueue<TaskGroupInfo*>* _readyQueues;
+        int _numNodes;
+        std::queue<TaskGroupInfo*> _overflowQueue; // used when a ready queue is full
+        std::mutex _overflowMutex;
+        std::atomic<int> _overflowCount;
+        // ready launches that need ordering: those with a priority, those
+        // with a deadline under SCHEDULE_EARLIEST_DEADLINE, and all of
+        // them under SCHEDULE_CRITICAL_PATH; a binary heap
+        std::vector<ReadyEntry> _priorityQueue;
+        std::mutex _priorityMutex;
+        std::atomic<int> _priorityCount;
+        std::atomic<bool> _criticalPath;
+        std::atomic<bool> _earliestDeadline;
+        std::atomic<long> _deadlineMisses;
+        // released parts of launches that depend on individual tasks
+        std::deque<TaskRangeInfo> _rangeQueue;
+        std::mutex _rangeMutex;
+        std::atomic<int> _rangeCount;
+        std::mutex _mutex; // guards the task graph
+        std::atomic<int> _activeTaskGroups;
+        unsigned long _numSubmitted; // launches so far; guarded by _mutex
+        ParkingLot _parking; // idle workers
+        std::condition_variable _sync_cv;
+        std::condition_variable _any_cv; // for waitAny()
+        int _anyWaiters; // guarded by _mutex
+        std::atomic<unsigned int> _finishEpoch; // bumped whenever a launch finishes
+        // callbacks of finished launches, not run yet; guarded by _mutex
+        std::vector<std::function<void()> > _readyCallbacks;
+        // finished launches whose callbacks are in _readyCallbacks; they
+        // count as active until the callbacks have run
+        std::atomic<int> _callbackGroups;
+        AdaptiveGrain _grain;
+        IdlePolicy _idle;
+        std::atomic<bool> _isDone;
+        void threadLoop(int worker_id);
+        void requestGrow();
+        void maybeGrow();
+        bool retireWorker(int worker_id);
+        void poolLoop(WorkerPool* pool, int worker_id);
+        void wakePool(WorkerPool* pool, int wake_count);
+        AdaptiveGrain& grainOf(TaskGroupInfo* group);
+        int threadsOf(TaskGroupInfo* group);
+        TaskGroupInfo* newGroup(IRunnable* runnable, int num_total_tasks,
+                                const LaunchOptions& options);
+        TaskRangeInfo claimChunk(TaskGroupInfo* group);
+        TaskRangeInfo takeChunk(TaskGroupInfo* group);
+        void runRange(const TaskRangeInfo& range);
+        void completeRange(TaskGroupInfo* group, int begin, int end);
+        void addTaskDependencies(TaskGroupInfo* group,
+                                 const std::vector<TaskGroupInfo*>& deps,
+                                 DependencyMode mode, std::vector<int>& waiters_begin,
+                                 std::vector<int>& waiters_of);
+        void releaseTasks(TaskGroupInfo* group, int begin, int end);
+        void pushRange(TaskGroupInfo* group, int begin, int end);
+        bool popRange(TaskRangeInfo* range);
+        void pushReady(TaskGroupInfo* group, int wake_count);
+        bool popReady(TaskRangeInfo* chunk);
+        bool popPriority(TaskRangeInfo* chunk, bool below_default);
+        void extendPath(TaskGroupInfo* group);
+        bool hasReady();
+        void releaseGroup(TaskGroupInfo* group);
+        void finishGroup(TaskGroupInfo* group);
+        void runCallbacks();
+        bool helpWhileWaiting(unsigned int epoch);
+        TaskID findDone(const std::vector<TaskID>& ids);
+};
+
+/*
+ * TaskSystemParallelThreadPoolStealing: parallel task execution engine
+ * where every worker owns a work-stealing deque. Ready launches are
+ * pushed as task ranges, which workers split lazily so that idle workers
+ * can steal the other half. See definition of ITaskSystem in
+ * itasksys.h for documentation of the ITaskSystem interface.
+ */
+class TaskSystemParallelThreadPoolStealing: public ITaskSystem {
+    public:
+        TaskSystemParallelThreadPoolStealing(int num_threads,
+                                             PlacementPolicy placement = PLACEMENT_NONE);
+        ~TaskSystemParallelThreadPoolStealing();
+        const char* name();
+        void run(IRunnable* runnable, int num_total_tasks);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
         void sync();
+        void wait(TaskID id);
+        int numWorkers();
     private:
         int _numThreads;
         std::thread* threads;
-        std::map<TaskID, TaskGroupInfo*> _allTaskGroups;
-        std::queue<TaskUnitInfo*> _taskQueue; // single task
-        std::mutex _mutex;
+        WorkStealingDeque<TaskRangeInfo*>* _deques; // one per worker
+        std::queue<TaskRangeInfo*> _injectQueue; // launches from outside the pool
+        std::mutex _injectMutex;
+        std::atomic<int> _injectCount;
+        TaskGroupTable _taskGroups;
+        std::mutex _mutex; // guards the task graph
         std::atomic<int> _activeTaskGroups;
-        std::atomic<int> _nextTaskGroupId;
-        std::condition_variable _worker_cv;
         std::condition_variable _sync_cv;
-        bool _isDone;
-        void threadLoop();
+        ParkingLot _parking; // idle workers
+        std::atomic<unsigned int> _workEpoch;
+        std::atomic<unsigned int> _finishEpoch; // bumped whenever a launch finishes
+        std::condition_variable _finish_cv; // for wait() from outside the pool
+        int _waiters; // threads blocked on _finish_cv; guarded by _mutex
+        IdlePolicy _idle;
+        std::atomic<bool> _isDone;
+        void threadLoop(int worker_id);
+        bool findWork(int worker_id, unsigned int* seed, TaskRangeInfo** range);
+        void executeRange(int worker_id, TaskRangeInfo* range);
+        void pushRange(int worker_id, TaskRangeInfo* range);
+        void scheduleGroup(int worker_id, TaskGroupInfo* group);
+        void completeGroup(int worker_id, TaskGroupInfo* group);
+        void notifyWork();
+        void waitForChildren(const std::vector<TaskID>& children);
 };
 
 #endif
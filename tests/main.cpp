@@ -16,6 +16,12 @@ void usage(const char* progname, std::string *testnames, int num_tests) {
     printf("Program Options:\n");
     printf("  -n  --num_threads  <INT>      Number of threads: <INT> (default=%d)\n", DEFAULT_NUM_THREADS);
     printf("  -i  --num_timing_iterations <INT> Number of timing iterations: <INT> (default=%d)\n", DEFAULT_NUM_TIMING_ITERATIONS);
+    printf("  -s  --spin_us <INT>           Idle workers spin for up to <INT> us before yielding (default=%ld)\n", IdleConfig().spin_ns / 1000);
+    printf("  -y  --yield_us <INT>          ... then yield for up to <INT> us before parking (default=%ld)\n", IdleConfig().yield_ns / 1000);
+    printf("  -f  --fixed_idle              Do not auto-tune the idle thresholds\n");
+    printf("  -p  --placement <POLICY>      Pin pool workers: none, compact, scatter or cores (default=none)\n");
+    printf("  -c  --critical_path           Start ready launches on the longest dependency chain first\n");
+    printf("  -e  --earliest_deadline       Start ready launches with the earliest LaunchOptions deadline first\n");
     printf("  -?  --help                    This message\n");
     printf("Valid testnames are:");
     for(int i = 0; i < num_tests; i++) {
@@ -28,10 +34,12 @@ enum TaskSystemType {
     PARALLEL_SPAWN,
     PARALLEL_THREAD_POOL_SPINNING,
     PARALLEL_THREAD_POOL_SLEEPING,
+    PARALLEL_THREAD_POOL_STEALING,
     N_TASKSYS_IMPLS, // This must be in the last position.
 };
 
-ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type) {
+ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type,
+                                     PlacementPolicy placement) {
     assert(type < N_TASKSYS_IMPLS);
 
     if (type == SERIAL) {
@@ -39,9 +47,11 @@ ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type) {
     } else if (type == PARALLEL_SPAWN) {
         return new TaskSystemParallelSpawn(num_threads);
     } else if (type == PARALLEL_THREAD_POOL_SPINNING) {
-        return new TaskSystemParallelThreadPoolSpinning(num_threads);
+        return new TaskSystemParallelThreadPoolSpinning(num_threads, placement);
     } else if (type == PARALLEL_THREAD_POOL_SLEEPING) {
-        return new TaskSystemParallelThreadPoolSleeping(num_threads);
+        return new TaskSystemParallelThreadPoolSleeping(num_threads, placement);
+    } else if (type == PARALLEL_THREAD_POOL_STEALING) {
+        return new TaskSystemParallelThreadPoolStealing(num_threads, placement);
     } else {
         return NULL;
     }
@@ -49,9 +59,11 @@ ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type) {
 
 int main(int argc, char** argv)
 {
-    const int n_tests = 31;
+    const int n_tests = 48;
     int num_threads = DEFAULT_NUM_THREADS;
     int num_timing_iterations = DEFAULT_NUM_TIMING_ITERATIONS;
+    PlacementPolicy placement = PLACEMENT_NONE;
+    SchedulingPolicy scheduling = SCHEDULE_FIFO;
 
     TestResults (*test[n_tests])(ITaskSystem*) = {
         simpleTestSync,
@@ -83,6 +95,23 @@ int main(int argc, char** argv)
         strictGraphDepsSmall,
         strictGraphDepsMedium,
         strictGraphDepsLarge,
+        lambdaLaunchTest,
+        lambdaLaunchAsyncTest,
+        parallelReduceTest,
+        waitTaskIdAsyncTest,
+        completionCallbackAsyncTest,
+        forkJoinSortTest,
+        forkJoinSortAsyncTest,
+        criticalPathDepsAsyncTest,
+        cancelDepsAsyncTest,
+        graphReplayAsyncTest,
+        pipelinedDepsAsyncTest,
+        finishedDepsAsyncTest,
+        streamSyncAsyncTest,
+        blockingPoolAsyncTest,
+        deadlineMissAsyncTest,
+        elasticPoolAsyncTest<TaskSystemParallelThreadPoolSleeping>,
+        heldLaunchAsyncTest,
     };
 
     std::string test_names[n_tests] = {
@@ -115,6 +144,23 @@ int main(int argc, char** argv)
         "strict_graph_deps_small_async",
         "strict_graph_deps_med_async",
         "strict_graph_deps_large_async",
+        "lambda_launch",
+        "lambda_launch_async",
+        "parallel_reduce",
+        "wait_task_id_async",
+        "completion_callback_async",
+        "fork_join_sort",
+        "fork_join_sort_async",
+        "critical_path_deps_async",
+        "cancel_deps_async",
+        "graph_replay_async",
+        "pipelined_deps_async",
+        "finished_deps_async",
+        "stream_sync_async",
+        "blocking_pool_async",
+        "deadline_miss_async",
+        "elastic_pool_async",
+        "held_launch_async",
     };
  
     // Parse commandline options
@@ -122,10 +168,16 @@ int main(int argc, char** argv)
     static struct option long_options[] = {
         {"num_threads",           1, 0,  'n'},
         {"num_timing_iterations", 1, 0,  'i'},
+        {"spin_us",               1, 0,  's'},
+        {"yield_us",              1, 0,  'y'},
+        {"fixed_idle",            0, 0,  'f'},
+        {"placement",             1, 0,  'p'},
+        {"critical_path",         0, 0,  'c'},
+        {"earliest_deadline",     0, 0,  'e'},
         {"help",                  0, 0,  '?'},
     };
 
-    while ((opt = getopt_long(argc, argv, "n:i:?", long_options, NULL)) != EOF) {
+    while ((opt = getopt_long(argc, argv, "n:i:s:y:fp:ce?", long_options, NULL)) != EOF) {
 
         switch (opt) {
         case 'n':
@@ -134,6 +186,28 @@ int main(int argc, char** argv)
         case 'i':
             num_timing_iterations = atoi(optarg);
             break;
+        case 's':
+            IdleConfig::current().spin_ns = atol(optarg) * 1000;
+            break;
+        case 'y':
+            IdleConfig::current().yield_ns = atol(optarg) * 1000;
+            break;
+        case 'f':
+            IdleConfig::current().adaptive = false;
+            break;
+        case 'p':
+            if (!Topology::parsePolicy(optarg, &placement)) {
+                fprintf(stderr, "Error: invalid placement policy!\n");
+                usage(argv[0], test_names, n_tests);
+                return 1;
+            }
+            break;
+        case 'c':
+            scheduling = SCHEDULE_CRITICAL_PATH;
+            break;
+        case 'e':
+            scheduling = SCHEDULE_EARLIEST_DEADLINE;
+            break;
         case '?':
         default:
             usage(argv[0], test_names, n_tests);
@@ -167,7 +241,8 @@ int main(int argc, char** argv)
             for (int j = 0; j < num_timing_iterations; j++) {
 
                 // Create a new task system
-                ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i);
+                ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i, placement);
+                t->setSchedulingPolicy(scheduling);
 
                 // Run test
                 TestResults result = test[test_id](t);
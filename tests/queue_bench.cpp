@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include "CycleTimer.h"
+#include "MPMCQueue.h"
+
+/*
+ * Throughput microbenchmark for the task systems' ready queue: P producer
+ * threads push N items in total while C consumer threads pop them. Compares
+ * MPMCQueue against the std::queue + std::mutex combination it replaced.
+ */
+
+#define DEFAULT_NUM_PRODUCERS 4
+#define DEFAULT_NUM_CONSUMERS 4
+#define DEFAULT_NUM_ITEMS (1 << 22)
+
+class LockedQueue {
+    public:
+        bool push(long item) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push(item);
+            return true;
+        }
+        bool pop(long* item) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_queue.empty()) return false;
+            *item = _queue.front();
+            _queue.pop();
+            return true;
+        }
+    private:
+        std::queue<long> _queue;
+        std::mutex _mutex;
+};
+
+template <typename Q>
+double runBench(Q& queue, int num_producers, int num_consumers, long num_items, bool* ok) {
+    std::atomic<long> consumed(0);
+    std::atomic<long> sum(0);
+    std::vector<std::thread> threads;
+
+    double start_time = CycleTimer::currentSeconds();
+    for (int p = 0; p < num_producers; p++) {
+        threads.push_back(std::thread([&, p] {
+            for (long i = p; i < num_items; i += num_producers) {
+                while (!queue.push(i)) {
+                    std::this_thread::yield();
+                }
+            }
+        }));
+    }
+    for (int c = 0; c < num_consumers; c++) {
+        threads.push_back(std::thread([&] {
+            long local_sum = 0;
+            long item;
+            while (consumed.load(std::memory_order_relaxed) < num_items) {
+                if (queue.pop(&item)) {
+                    local_sum += item;
+                    consumed.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            sum.fetch_add(local_sum);
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    *ok = (sum.load() == num_items * (num_items - 1) / 2);
+    return end_time - start_time;
+}
+
+void usage(const char* progname) {
+    printf("Usage: %s [options]\n", progname);
+    printf("Program Options:\n");
+    printf("  -p  --producers <INT>  Number of producer threads (default=%d)\n", DEFAULT_NUM_PRODUCERS);
+    printf("  -c  --consumers <INT>  Number of consumer threads (default=%d)\n", DEFAULT_NUM_CONSUMERS);
+    printf("  -n  --items <INT>      Number of items pushed in total (default=%d)\n", DEFAULT_NUM_ITEMS);
+    printf("  -?  --help             This message\n");
+}
+
+int main(int argc, char** argv) {
+    int num_producers = DEFAULT_NUM_PRODUCERS;
+    int num_consumers = DEFAULT_NUM_CONSUMERS;
+    long num_items = DEFAULT_NUM_ITEMS;
+
+    int opt;
+    static struct option long_options[] = {
+        {"producers", 1, 0, 'p'},
+        {"consumers", 1, 0, 'c'},
+        {"items",     1, 0, 'n'},
+        {"help",      0, 0, '?'},
+        {0, 0, 0, 0},
+    };
+    while ((opt = getopt_long(argc, argv, "p:c:n:?", long_options, NULL)) != EOF) {
+        switch (opt) {
+        case 'p':
+            num_producers = atoi(optarg);
+            break;
+        case 'c':
+            num_consumers = atoi(optarg);
+            break;
+        case 'n':
+            num_items = atol(optarg);
+            break;
+        case '?':
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%d producers, %d consumers, %ld items\n", num_producers, num_consumers, num_items);
+
+    bool ok;
+    MPMCQueue<long> mpmc(10);
+    double t = runBench(mpmc, num_producers, num_consumers, num_items, &ok);
+    printf("[MPMCQueue]:\t\t[%.3f] Mops/s%s\n", num_items / t / 1e6, ok ? "" : " (WRONG SUM)");
+
+    LockedQueue locked;
+    t = runBench(locked, num_producers, num_consumers, num_items, &ok);
+    printf("[std::queue + mutex]:\t[%.3f] Mops/s%s\n", num_items / t / 1e6, ok ? "" : " (WRONG SUM)");
+
+    return 0;
+}
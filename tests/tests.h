@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <math.h>
@@ -5,9 +6,15 @@
 #include <stdio.h>
 #include <thread>
 #include <atomic>
+#include <climits>
 #include <set>
+#include <type_traits>
+#include <sys/resource.h>
 
 #include "CycleTimer.h"
+#include "NumaAlloc.h"
+#include "TaskGraph.h"
+#include "TaskStream.h"
 #include "itasksys.h"
 
 /*
@@ -23,6 +30,9 @@ TestResults mathOperationsInTightForLoopFanInTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopReductionTreeTest(ITaskSystem* t);
 TestResults spinBetweenRunCallsTest(ITaskSystem *t);
 TestResults mandelbrotChunkedTest(ITaskSystem* t);
+TestResults forkJoinSortTest(ITaskSystem* t);
+TestResults lambdaLaunchTest(ITaskSystem* t);
+TestResults parallelReduceTest(ITaskSystem* t);
 
 Async with dependencies tests
 =============================
@@ -36,6 +46,20 @@ TestResults mathOperationsInTightForLoopFanInAsyncTest(ITaskSystem* t);
 TestResults mathOperationsInTightForLoopReductionTreeAsyncTest(ITaskSystem* t);
 TestResults spinBetweenRunCallsAsyncTest(ITaskSystem *t);
 TestResults mandelbrotChunkedAsyncTest(ITaskSystem* t);
+TestResults forkJoinSortAsyncTest(ITaskSystem* t);
+TestResults criticalPathDepsAsyncTest(ITaskSystem* t);
+TestResults cancelDepsAsyncTest(ITaskSystem* t);
+TestResults graphReplayAsyncTest(ITaskSystem* t);
+TestResults pipelinedDepsAsyncTest(ITaskSystem* t);
+TestResults finishedDepsAsyncTest(ITaskSystem* t);
+TestResults heldLaunchAsyncTest(ITaskSystem* t);
+TestResults streamSyncAsyncTest(ITaskSystem* t);
+TestResults blockingPoolAsyncTest(ITaskSystem* t);
+TestResults deadlineMissAsyncTest(ITaskSystem* t);
+template <typename Pool> TestResults elasticPoolAsyncTest(ITaskSystem* t);
+TestResults lambdaLaunchAsyncTest(ITaskSystem* t);
+TestResults waitTaskIdAsyncTest(ITaskSystem* t);
+TestResults completionCallbackAsyncTest(ITaskSystem* t);
 TestResults simpleRunDepsTest(ITaskSystem *t);
 */
 
@@ -123,7 +147,7 @@ TestResults yourTest(ITaskSystem* t, bool do_async, int num_elements, int num_bu
  * Each task performs a number of multiplies and divides in-place on a partial
  * input array. This is designed to be used as a basic correctness test.
 */
-class SimpleMultiplyTask : public IRunnable {
+class SimpleMultiplyTask : public IRangeRunnable {
     public:
         int num_elements_;
         int* array_;
@@ -140,11 +164,11 @@ class SimpleMultiplyTask : public IRunnable {
             return accumulator;
         }
 
-        void runTask(int task_id, int num_total_tasks) {
+        void runRange(int begin, int end, int num_total_tasks) {
             // handle case where num_elements is not evenly divisible by num_total_tasks
             int elements_per_task = (num_elements_ + num_total_tasks-1) / num_total_tasks;
-            int start_el = elements_per_task * task_id;
-            int end_el = std::min(start_el + elements_per_task, num_elements_);
+            int start_el = elements_per_task * begin;
+            int end_el = std::min(elements_per_task * end, num_elements_);
 
             for (int i=start_el; i<end_el; i++)
                 array_[i] = multiply_task(3, array_[i]);
@@ -156,7 +180,7 @@ class SimpleMultiplyTask : public IRunnable {
  * is incremented in a tight for loop. The `equal_work_` field ensures that
  * each element of the output array requires a different amount of computation.
  */
-class PingPongTask : public IRunnable {
+class PingPongTask : public IRangeRunnable {
     public:
         int num_elements_;
         int* input_array_;
@@ -186,12 +210,12 @@ class PingPongTask : public IRunnable {
             return accum;
         }
 
-        void runTask(int task_id, int num_total_tasks) {
+        void runRange(int begin, int end, int num_total_tasks) {
 
             // handle case where num_elements is not evenly divisible by num_total_tasks
             int elements_per_task = (num_elements_ + num_total_tasks-1) / num_total_tasks;
-            int start_el = elements_per_task * task_id;
-            int end_el = std::min(start_el + elements_per_task, num_elements_);
+            int start_el = elements_per_task * begin;
+            int end_el = std::min(elements_per_task * end, num_elements_);
 
             if (equal_work_) {
                 for (int i=start_el; i<end_el; i++)
@@ -227,6 +251,88 @@ class RecursiveFibonacciTask: public IRunnable {
         }
 };
 
+/*
+ * Recursive fork-join quicksort. The task's range [begin_, end_) has been
+ * partitioned around its middle, and task i sorts half i. A half larger
+ * than cutoff_ is partitioned again and sorted by a nested bulk launch of
+ * two tasks, issued from inside this task.
+ */
+class ForkJoinSortTask: public IRunnable {
+    public:
+        static const int cutoff_ = 1 << 13;
+        ITaskSystem* t_;
+        int* data_;
+        int begin_;
+        int end_;
+        bool do_async_;
+        ForkJoinSortTask(ITaskSystem* t, int* data, int begin, int end, bool do_async)
+            : t_(t), data_(data), begin_(begin), end_(end), do_async_(do_async) {}
+        ~ForkJoinSortTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            int mid = begin_ + (end_ - begin_) / 2;
+            int lo = (task_id == 0) ? begin_ : mid;
+            int hi = (task_id == 0) ? mid : end_;
+            if (hi - lo <= cutoff_) {
+                std::sort(data_ + lo, data_ + hi);
+                return;
+            }
+
+            std::nth_element(data_ + lo, data_ + lo + (hi - lo) / 2, data_ + hi);
+            ForkJoinSortTask child(t_, data_, lo, hi, do_async_);
+            if (do_async_) {
+                t_->runAsyncWithDeps(&child, 2, std::vector<TaskID>());
+                t_->sync();
+            } else {
+                t_->run(&child, 2);
+            }
+        }
+};
+
+/*
+ * Each task increments one element of a block of data, starting at begin.
+ */
+class BlockIncrementTask: public IRunnable {
+    public:
+        int* data_;
+        int begin_;
+        BlockIncrementTask(int* data, int begin) : data_(data), begin_(begin) {}
+        ~BlockIncrementTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            data_[begin_ + task_id] += 1;
+        }
+};
+
+/*
+ * Task i sums block i of data into sums[i]; a launch of one task instead
+ * adds up all num_blocks entries of sums into *total.
+ */
+class BlockSumTask: public IRunnable {
+    public:
+        int* data_;
+        int block_size_;
+        long* sums_;
+        int num_blocks_;
+        long* total_;
+        BlockSumTask(int* data, int block_size, long* sums, int num_blocks, long* total)
+            : data_(data), block_size_(block_size), sums_(sums), num_blocks_(num_blocks),
+              total_(total) {}
+        ~BlockSumTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            if (num_total_tasks == 1) {
+                long total = 0;
+                for (int i = 0; i < num_blocks_; i++) total += sums_[i];
+                *total_ = total;
+                return;
+            }
+            long sum = 0;
+            for (int i = 0; i < block_size_; i++) sum += data_[task_id * block_size_ + i];
+            sums_[task_id] = sum;
+        }
+};
+
 /*
  * Each task copies its task id into the output.
  */
@@ -241,11 +347,48 @@ class LightTask: public IRunnable {
         }
 };
 
+/*
+ * Each task zeroes one contiguous block of an array. Run on the task system
+ * under test right after numaAlloc(), so that the array's pages are first
+ * touched, and hence placed, by the pool's workers instead of the main
+ * thread.
+ */
+template <typename T>
+class FirstTouchTask: public IRunnable {
+    public:
+        T* data_;
+        size_t count_;
+        FirstTouchTask(T* data, size_t count): data_(data), count_(count) {}
+        ~FirstTouchTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            size_t start = count_ * task_id / num_total_tasks;
+            size_t end = count_ * (task_id + 1) / num_total_tasks;
+            for (size_t i = start; i < end; i++) {
+                data_[i] = T();
+            }
+        }
+};
+
+/*
+ * Allocates a zeroed array of `count` elements whose pages are spread over
+ * the NUMA nodes of t's workers. Free with numaFree(). Returns NULL if the
+ * allocation fails.
+ */
+template <typename T>
+T* firstTouchAlloc(ITaskSystem* t, size_t count, int num_tasks = 64) {
+    T* data = numaAlloc<T>(count);
+    if (data == NULL) return NULL;
+    FirstTouchTask<T> touch(data, count);
+    t->run(&touch, num_tasks);
+    return data;
+}
+
 /*
  * Each task performs a sequence of exp, log, and multiplication
  * operations in a tight for loop.
  */
-class MathOperationsInTightForLoopTask: public IRunnable {
+class MathOperationsInTightForLoopTask: public IRangeRunnable {
     public:
         float* output_;
         int array_size_;
@@ -255,10 +398,11 @@ class MathOperationsInTightForLoopTask: public IRunnable {
         }
         ~MathOperationsInTightForLoopTask() {}
 
-        void runTask(int task_id, int num_total_tasks) {
+        void runRange(int begin_task, int end_task, int num_total_tasks) {
+            // the last task also takes the remainder
             int elements_per_task = array_size_ / num_total_tasks;
-            int start = task_id * elements_per_task;
-            int end = std::min(start + elements_per_task, array_size_);
+            int start = begin_task * elements_per_task;
+            int end = std::min(end_task * elements_per_task, array_size_);
             if (array_size_ - end < elements_per_task) {
                 end = array_size_;
             }
@@ -435,6 +579,45 @@ class SleepTask: public IRunnable {
         }
 };
 
+/*
+ * Holds workers of a task system in a launch of its own: task i blocks
+ * until release() has let more than i tasks go. hold() starts one task
+ * per worker, so that launches submitted while they are held queue up in
+ * the engine's ready queue. Only for engines that run asynchronous
+ * launches on their workers.
+ */
+class WorkerGate: public IRunnable {
+    public:
+        WorkerGate() : started_(0), released_(0) {}
+        ~WorkerGate() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            started_++;
+            while (released_.load() <= task_id) {
+                std::this_thread::yield();
+            }
+        }
+
+        TaskID hold(ITaskSystem* t) {
+            int num_workers = t->numWorkers();
+            LaunchOptions options;
+            options.grain_size = 1;
+            TaskID id = t->runAsyncWithOptions(this, num_workers, std::vector<TaskID>(), options);
+            while (started_.load() < num_workers) {
+                std::this_thread::yield();
+            }
+            return id;
+        }
+
+        void release(int num_tasks) {
+            released_.store(num_tasks);
+        }
+
+    private:
+        std::atomic<int> started_;
+        std::atomic<int> released_;
+};
+
 /*
  * This task sets its "done" flag when the following conditions are met:
  *  - All dependencies have their "done" flag set prior to the first
@@ -788,10 +971,13 @@ TestResults mathOperationsInTightForLoopTestBase(ITaskSystem* t, int num_tasks,
     int num_bulk_task_launches = 2000;
 
     int array_size = 512;
-    float* task_output = new float[num_bulk_task_launches * array_size];
-
-    for (int i = 0; i < (num_bulk_task_launches * array_size); i++) {
-        task_output[i] = 0.0;
+    float* task_output = firstTouchAlloc<float>(t, num_bulk_task_launches * array_size);
+    if (task_output == NULL) {
+        printf("could not allocate the output array\n");
+        TestResults result;
+        result.passed = false;
+        result.time = 0;
+        return result;
     }
 
     std::vector<MathOperationsInTightForLoopTask> medium_tasks;
@@ -847,7 +1033,7 @@ TestResults mathOperationsInTightForLoopTestBase(ITaskSystem* t, int num_tasks,
     }
     result.time = end_time - start_time;
 
-    delete [] task_output;
+    numaFree(task_output, num_bulk_task_launches * array_size);
 
     return result;
 }
@@ -1189,9 +1375,13 @@ TestResults mandelbrotChunkedTestBase(ITaskSystem* t, bool do_async) {
     ma.width = 1600;
     ma.height = 1200;
     ma.max_iterations = 256;
-    ma.output = new int[ma.width * ma.height];
-    for (int i = 0; i < (ma.width * ma.height); i++) {
-        ma.output[i] = 0;
+    ma.output = firstTouchAlloc<int>(t, ma.width * ma.height);
+    if (ma.output == NULL) {
+        printf("could not allocate the output image\n");
+        TestResults result;
+        result.passed = false;
+        result.time = 0;
+        return result;
     }
 
     MandelbrotTask mandel_task(&ma, true);  // No interleaving
@@ -1227,7 +1417,7 @@ TestResults mandelbrotChunkedTestBase(ITaskSystem* t, bool do_async) {
     result.time = end_time - start_time;
 
     delete [] golden;
-    delete [] ma.output;
+    numaFree(ma.output, ma.width * ma.height);
 
     return result;
 }
@@ -1240,6 +1430,1169 @@ TestResults mandelbrotChunkedAsyncTest(ITaskSystem* t) {
     return mandelbrotChunkedTestBase(t, true);
 }
 
+/*
+ * Computation: a chain of bulk launches of very light tasks, submitted
+ * through the callable-based ITaskSystem::launch()/launchAsync() API
+ * instead of IRunnable subclasses. Each launch updates every element of
+ * an array in place, so a launch that starts before its predecessor has
+ * finished produces wrong values. The async variant also chains an empty
+ * launch.
+ */
+TestResults lambdaLaunchTestBase(ITaskSystem* t, bool do_async) {
+    int num_elements = 1 << 16;
+    int num_bulk_task_launches = 200;
+
+    int* array = new int[num_elements];
+    for (int i = 0; i < num_elements; i++) {
+        array[i] = i;
+    }
+
+    auto step = [array](int i, int num_total_tasks) {
+        array[i] = (array[i] * 3 + 1) % 1000003;
+    };
+
+    double start_time = CycleTimer::currentSeconds();
+    if (do_async) {
+        std::vector<TaskID> deps;
+        for (int j = 0; j < num_bulk_task_launches; j++) {
+            TaskID id = t->launchAsync(num_elements, step, deps);
+            if (j == num_bulk_task_launches / 2) {
+                id = t->launchAsync(0, step, std::vector<TaskID>(1, id));
+            }
+            deps = std::vector<TaskID>(1, id);
+        }
+        t->sync();
+    } else {
+        for (int j = 0; j < num_bulk_task_launches; j++) {
+            t->launch(num_elements, step);
+        }
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults results;
+    results.passed = true;
+    for (int i = 0; i < num_elements; i++) {
+        int expected = i;
+        for (int j = 0; j < num_bulk_task_launches; j++) {
+            expected = (expected * 3 + 1) % 1000003;
+        }
+        if (array[i] != expected) {
+            results.passed = false;
+            printf("%d: %d expected=%d\n", i, array[i], expected);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+
+    delete [] array;
+    return results;
+}
+
+TestResults lambdaLaunchTest(ITaskSystem* t) {
+    return lambdaLaunchTestBase(t, false);
+}
+
+TestResults lambdaLaunchAsyncTest(ITaskSystem* t) {
+    return lambdaLaunchTestBase(t, true);
+}
+
+/*
+ * Computation: two independent chains of launches, each updating its own
+ * array in place. Waits for each chain with wait()/waitAny()/waitAll()
+ * instead of sync() and checks that the array of a chain is final as soon
+ * as the wait for its last launch returns.
+ */
+TestResults waitTaskIdAsyncTest(ITaskSystem* t) {
+    int num_elements = 1 << 14;
+    int chain_length = 50;
+
+    int* a = new int[num_elements];
+    int* b = new int[num_elements];
+    for (int i = 0; i < num_elements; i++) {
+        a[i] = i;
+        b[i] = i;
+    }
+
+    auto step_a = [a](int i, int num_total_tasks) {
+        a[i] = (a[i] * 3 + 1) % 1000003;
+    };
+    auto step_b = [b](int i, int num_total_tasks) {
+        b[i] = (b[i] * 5 + 2) % 1000003;
+    };
+
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<TaskID> deps_a;
+    std::vector<TaskID> deps_b;
+    for (int j = 0; j < chain_length; j++) {
+        deps_a = std::vector<TaskID>(1, t->launchAsync(num_elements, step_a, deps_a));
+        deps_b = std::vector<TaskID>(1, t->launchAsync(num_elements, step_b, deps_b));
+    }
+    TaskID last_a = deps_a[0];
+    TaskID last_b = deps_b[0];
+
+    TestResults results;
+    results.passed = true;
+
+    t->wait(last_b);
+    if (!t->isDone(last_b)) {
+        results.passed = false;
+        printf("isDone() is false after wait()\n");
+    }
+    for (int i = 0; i < num_elements && results.passed; i++) {
+        int expected = i;
+        for (int j = 0; j < chain_length; j++) {
+            expected = (expected * 5 + 2) % 1000003;
+        }
+        if (b[i] != expected) {
+            results.passed = false;
+            printf("b[%d]: %d expected=%d\n", i, b[i], expected);
+        }
+    }
+
+    std::vector<TaskID> both;
+    both.push_back(last_a);
+    both.push_back(last_b);
+    TaskID any = t->waitAny(both);
+    if ((any != last_a && any != last_b) || !t->isDone(any)) {
+        results.passed = false;
+        printf("waitAny() returned %d\n", any);
+    }
+
+    t->waitAll(both);
+    double end_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_elements && results.passed; i++) {
+        int expected = i;
+        for (int j = 0; j < chain_length; j++) {
+            expected = (expected * 3 + 1) % 1000003;
+        }
+        if (a[i] != expected) {
+            results.passed = false;
+            printf("a[%d]: %d expected=%d\n", i, a[i], expected);
+        }
+    }
+    t->sync();
+    results.time = end_time - start_time;
+
+    delete [] a;
+    delete [] b;
+    return results;
+}
+
+/*
+ * Computation: a chain of launches updating an array in place, with an
+ * onComplete() callback on every launch and a then() continuation that
+ * copies out the final values. The callback of the last launch submits
+ * one more launch from whichever thread runs it, which sync() must also
+ * wait for.
+ */
+TestResults completionCallbackAsyncTest(ITaskSystem* t) {
+    int num_elements = 1 << 14;
+    int chain_length = 50;
+
+    int* array = new int[num_elements];
+    int* copy = new int[num_elements];
+    int* negated = new int[num_elements];
+    for (int i = 0; i < num_elements; i++) {
+        array[i] = i;
+        copy[i] = -1;
+        negated[i] = 0;
+    }
+
+    auto step = [array](int i, int num_total_tasks) {
+        array[i] = (array[i] * 3 + 1) % 1000003;
+    };
+    auto copy_out = [array, copy](int i, int num_total_tasks) {
+        copy[i] = array[i];
+    };
+    auto negate = [array, negated](int i, int num_total_tasks) {
+        negated[i] = -array[i];
+    };
+    std::atomic<int> num_callbacks(0);
+
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<TaskID> deps;
+    for (int j = 0; j < chain_length; j++) {
+        TaskID id = t->launchAsync(num_elements, step, deps);
+        t->onComplete(id, [&num_callbacks] { num_callbacks++; });
+        deps = std::vector<TaskID>(1, id);
+    }
+    t->then(deps[0], num_elements, copy_out);
+    t->onComplete(deps[0], [t, num_elements, negate] {
+        t->launchAsync(num_elements, negate);
+    });
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults results;
+    results.passed = true;
+    if (num_callbacks.load() != chain_length) {
+        results.passed = false;
+        printf("%d callbacks ran, expected %d\n", num_callbacks.load(), chain_length);
+    }
+    for (int i = 0; i < num_elements && results.passed; i++) {
+        int expected = i;
+        for (int j = 0; j < chain_length; j++) {
+            expected = (expected * 3 + 1) % 1000003;
+        }
+        if (copy[i] != expected || negated[i] != -expected) {
+            results.passed = false;
+            printf("%d: copy=%d negated=%d expected=%d\n", i, copy[i], negated[i], expected);
+        }
+    }
+
+    // the launch is done, so the callback runs right away
+    bool ran = false;
+    t->onComplete(deps[0], [&ran] { ran = true; });
+    if (!ran) {
+        results.passed = false;
+        printf("callback on a finished launch did not run\n");
+    }
+    results.time = end_time - start_time;
+
+    delete [] array;
+    delete [] copy;
+    delete [] negated;
+    return results;
+}
+
+/*
+ * Computation: sorts a large array with ForkJoinSortTask, so that every
+ * level of the recursion is a bulk launch issued, and waited for, from
+ * inside a task of the level above. Checks the result against std::sort.
+ */
+TestResults forkJoinSortTestBase(ITaskSystem* t, bool do_async) {
+    int num_elements = 1 << 21;
+
+    int* data = new int[num_elements];
+    int* expected = new int[num_elements];
+    unsigned int seed = 12345;
+    for (int i = 0; i < num_elements; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (int)(seed >> 1);
+        expected[i] = data[i];
+    }
+    std::sort(expected, expected + num_elements);
+
+    double start_time = CycleTimer::currentSeconds();
+    std::nth_element(data, data + num_elements / 2, data + num_elements);
+    ForkJoinSortTask root(t, data, 0, num_elements, do_async);
+    if (do_async) {
+        t->runAsyncWithDeps(&root, 2, std::vector<TaskID>());
+        t->sync();
+    } else {
+        t->run(&root, 2);
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults results;
+    results.passed = true;
+    for (int i = 0; i < num_elements; i++) {
+        if (data[i] != expected[i]) {
+            results.passed = false;
+            printf("%d: %d expected=%d\n", i, data[i], expected[i]);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+
+    delete [] data;
+    delete [] expected;
+    return results;
+}
+
+TestResults forkJoinSortTest(ITaskSystem* t) {
+    return forkJoinSortTestBase(t, false);
+}
+
+TestResults forkJoinSortAsyncTest(ITaskSystem* t) {
+    return forkJoinSortTestBase(t, true);
+}
+
+/*
+ * Computation: an uneven DAG under SCHEDULE_CRITICAL_PATH. One long chain
+ * of narrow launches updates a small array in place, while many wide,
+ * independent launches, some with a positive and some with a negative
+ * LaunchOptions::priority, each fill their own row of a table. Checks
+ * that reordering ready launches never breaks a dependency. Then, on
+ * engines that support the policy, holds all workers but one and checks
+ * that this worker runs a chain of launches ahead of the independent
+ * launches queued next to it, also when these are wider than each link
+ * and were submitted before the chain.
+ */
+TestResults criticalPathDepsAsyncTest(ITaskSystem* t) {
+    int chain_length = 200;
+    int chain_width = 4;
+    int num_wide = 100;
+    int wide_width = 1024;
+
+    int* chain = new int[chain_width];
+    int* table = new int[num_wide * wide_width];
+    for (int i = 0; i < chain_width; i++) {
+        chain[i] = i;
+    }
+
+    auto step = [chain](int i, int num_total_tasks) {
+        chain[i] = (chain[i] * 3 + 1) % 1000003;
+    };
+
+    t->setSchedulingPolicy(SCHEDULE_CRITICAL_PATH);
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<TaskID> deps;
+    for (int j = 0; j < chain_length; j++) {
+        deps = std::vector<TaskID>(1, t->launchAsync(chain_width, step, deps));
+        if (j < num_wide) {
+            int* row = table + j * wide_width;
+            LaunchOptions options;
+            options.priority = (j % 3) - 1;
+            t->launchAsync(wide_width, [row, j](int i, int num_total_tasks) {
+                row[i] = j * i;
+            }, std::vector<TaskID>(), options);
+        }
+    }
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults results;
+    results.passed = true;
+    for (int i = 0; i < chain_width; i++) {
+        int expected = i;
+        for (int j = 0; j < chain_length; j++) {
+            expected = (expected * 3 + 1) % 1000003;
+        }
+        if (chain[i] != expected) {
+            results.passed = false;
+            printf("chain[%d]: %d expected=%d\n", i, chain[i], expected);
+        }
+    }
+    for (int j = 0; j < num_wide && results.passed; j++) {
+        for (int i = 0; i < wide_width; i++) {
+            if (table[j * wide_width + i] != j * i) {
+                results.passed = false;
+                printf("table[%d][%d]: %d expected=%d\n", j, i, table[j * wide_width + i], j * i);
+                break;
+            }
+        }
+    }
+    results.time = end_time - start_time;
+
+    delete [] chain;
+    delete [] table;
+
+    if (!t->setSchedulingPolicy(SCHEDULE_CRITICAL_PATH) || t->numWorkers() == 0) {
+        return results;
+    }
+    // first the chain is submitted ahead of one-task side launches, then
+    // after side launches wider than each of its links: its first links
+    // still lead the longer path, so they must run first either way
+    int num_links = 8;
+    int num_side = 32;
+    for (int round = 0; round < 2 && results.passed; round++) {
+        int side_width = (round == 0) ? 1 : num_links / 2;
+        std::atomic<int> next_slot(0);
+        std::vector<int> slot(num_links + num_side * side_width, -1);
+        WorkerGate gate;
+        gate.hold(t);
+        auto submit_side = [&]() {
+            for (int j = 0; j < num_side; j++) {
+                int* out = &slot[num_links + j * side_width];
+                t->launchAsync(side_width, [out, &next_slot](int i, int n) {
+                    out[i] = next_slot++;
+                });
+            }
+        };
+        if (round == 1) {
+            submit_side();
+        }
+        // every link waits for the one before, so the chain becomes ready
+        // a launch at a time
+        deps.clear();
+        for (int j = 0; j < num_links; j++) {
+            int* out = &slot[j];
+            deps = std::vector<TaskID>(1, t->launchAsync(1, [out, &next_slot](int i, int n) {
+                *out = next_slot++;
+            }, deps));
+        }
+        if (round == 0) {
+            submit_side();
+        }
+        gate.release(1);
+        while (next_slot.load() < (int)slot.size()) {
+            std::this_thread::yield();
+        }
+        gate.release(t->numWorkers());
+        t->sync();
+        // a link ranks above the side launches while the chain from it on
+        // has more tasks left than a side launch; in the first round the
+        // chain also wins ties, being older
+        int num_checked = (round == 0) ? num_links : num_links - side_width;
+        for (int j = 0; j < num_checked; j++) {
+            if (slot[j] != j) {
+                results.passed = false;
+                printf("link %d of the chain ran %dth, expected %dth (side launches of %d tasks)\n",
+                       j, slot[j], j, side_width);
+                break;
+            }
+        }
+    }
+    return results;
+}
+
+/*
+ * Computation: a gate launch, a chain of launches behind it, and an
+ * independent launch. Cancels the first launch of the chain while the
+ * gate is still held closed, then submits a pipelined launch behind the
+ * cancelled one and opens the gate. If cancel() reports success, no task
+ * of the rest of the chain or of the pipelined launch may run; the
+ * independent launch always runs in full. Engines that cannot cancel run
+ * everything.
+ */
+TestResults cancelDepsAsyncTest(ITaskSystem* t) {
+    int chain_length = 20;
+    int num_tasks = 64;
+
+    std::atomic<int> chain_tasks_run(0);
+    std::atomic<int> other_tasks_run(0);
+    // engines without workers run launches inline, so never hold them
+    std::atomic<bool> open(t->numWorkers() == 0);
+    auto closed = [&open](int i, int num_total_tasks) {
+        while (!open.load()) {
+            std::this_thread::yield();
+        }
+    };
+    auto chain_step = [&chain_tasks_run](int i, int num_total_tasks) {
+        chain_tasks_run++;
+    };
+    auto other = [&other_tasks_run](int i, int num_total_tasks) {
+        other_tasks_run++;
+    };
+
+    double start_time = CycleTimer::currentSeconds();
+    TaskID gate = t->launchAsync(1, closed);
+    std::vector<TaskID> deps(1, gate);
+    TaskID first = -1;
+    for (int j = 0; j < chain_length; j++) {
+        deps = std::vector<TaskID>(1, t->launchAsync(num_tasks, chain_step, deps));
+        if (j == 0) first = deps[0];
+    }
+    t->launchAsync(num_tasks, other);
+    bool cancelled = t->cancel(first);
+    LaunchOptions pipelined;
+    pipelined.dependency_mode = DEPEND_ELEMENTWISE;
+    t->launchAsync(num_tasks, chain_step, std::vector<TaskID>(1, first), pipelined);
+    open.store(true);
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults results;
+    results.passed = true;
+    int expected_chain = cancelled ? 0 : (chain_length + 1) * num_tasks;
+    if (chain_tasks_run.load() != expected_chain) {
+        results.passed = false;
+        printf("%d chain tasks ran, expected %d (cancel() returned %d)\n",
+               chain_tasks_run.load(), expected_chain, (int)cancelled);
+    }
+    if (other_tasks_run.load() != num_tasks) {
+        results.passed = false;
+        printf("%d independent tasks ran, expected %d\n", other_tasks_run.load(), num_tasks);
+    }
+    if (t->cancel(first)) {
+        results.passed = false;
+        printf("cancel() of a finished launch returned true\n");
+    }
+    results.time = end_time - start_time;
+    return results;
+}
+
+/*
+ * Computation: records a fan-in graph once with TaskGraphCapture (a layer
+ * of block increments, a launch summing each block, and, after a
+ * barrier, one task adding up the sums) and replays it many times. The
+ * final node is re-bound between replays to alternate between two
+ * outputs. Checks the total after every replay.
+ */
+TestResults graphReplayAsyncTest(ITaskSystem* t) {
+    int num_blocks = 16;
+    int block_size = 4096;
+    int num_replays = 100;
+
+    int* data = new int[num_blocks * block_size];
+    long* sums = new long[num_blocks];
+    long totals[2] = {0, 0};
+    for (int i = 0; i < num_blocks * block_size; i++) {
+        data[i] = 0;
+    }
+
+    std::vector<BlockIncrementTask*> increments;
+    for (int k = 0; k < num_blocks; k++) {
+        increments.push_back(new BlockIncrementTask(data, k * block_size));
+    }
+    BlockSumTask block_sums(data, block_size, sums, num_blocks, NULL);
+    BlockSumTask total_a(data, block_size, sums, num_blocks, &totals[0]);
+    BlockSumTask total_b(data, block_size, sums, num_blocks, &totals[1]);
+
+    TaskGraphCapture capture;
+    std::vector<TaskID> leaves;
+    for (int k = 0; k < num_blocks; k++) {
+        leaves.push_back(capture.runAsyncWithDeps(increments[k], block_size, std::vector<TaskID>()));
+    }
+    capture.runAsyncWithDeps(&block_sums, num_blocks, leaves);
+    capture.sync();
+    TaskID total = capture.runAsyncWithDeps(&total_a, 1, std::vector<TaskID>());
+    TaskGraph graph = capture.graph();
+
+    TestResults results;
+    results.passed = true;
+    double start_time = CycleTimer::currentSeconds();
+    for (int r = 0; r < num_replays && results.passed; r++) {
+        graph.bind(total, (r % 2) ? &total_b : &total_a);
+        t->replay(graph);
+        t->sync();
+        long expected = (long)(r + 1) * num_blocks * block_size;
+        if (totals[r % 2] != expected) {
+            results.passed = false;
+            printf("replay %d: %ld expected=%ld\n", r, totals[r % 2], expected);
+        }
+    }
+    double end_time = CycleTimer::currentSeconds();
+    results.time = end_time - start_time;
+
+    for (int k = 0; k < num_blocks; k++) {
+        delete increments[k];
+    }
+    delete [] data;
+    delete [] sums;
+    return results;
+}
+
+/*
+ * Computation: a chain of bulk launches, each computing one array from
+ * the previous one. Most stages read the element with their own index
+ * and depend on the previous stage with DEPEND_ELEMENTWISE, or every
+ * seventh one with DEPEND_MAPPED but no map, which waits for the whole
+ * stage; every fifth stage reads the mirrored element and uses
+ * DEPEND_MAPPED instead. Every eleventh stage maps its odd tasks past
+ * the end of the previous stage, up to INT_MAX, so that those wait for
+ * nothing and must not read it. Every stage writes a fresh array, so a
+ * task only races with the tasks it depends on. Compares the last array
+ * against a serial computation.
+ */
+TestResults pipelinedDepsAsyncTest(ITaskSystem* t) {
+    int num_stages = 32;
+    int num_elements = 4096;
+
+    std::vector<int*> arrays;
+    for (int s = 0; s <= num_stages; s++) {
+        arrays.push_back(new int[num_elements]);
+    }
+    for (int i = 0; i < num_elements; i++) {
+        arrays[0][i] = i;
+    }
+
+    LaunchOptions elementwise;
+    elementwise.dependency_mode = DEPEND_ELEMENTWISE;
+    LaunchOptions mirrored;
+    mirrored.dependency_mode = DEPEND_MAPPED;
+    mirrored.dependency_map = [num_elements](int i) { return num_elements - 1 - i; };
+    LaunchOptions unmapped;
+    unmapped.dependency_mode = DEPEND_MAPPED;
+    LaunchOptions out_of_range;
+    out_of_range.dependency_mode = DEPEND_MAPPED;
+    out_of_range.dependency_map = [](int i) {
+        return (i % 2 == 0) ? i : (i % 4 == 1) ? INT_MAX : 2000000000;
+    };
+
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<TaskID> deps;
+    for (int s = 1; s <= num_stages; s++) {
+        const int* in = arrays[s - 1];
+        int* out = arrays[s];
+        TaskID id;
+        if (s % 5 == 0) {
+            id = t->launchAsync(num_elements, [in, out](int i, int n) {
+                out[i] = in[n - 1 - i] + 1;
+            }, deps, mirrored);
+        } else if (s % 11 == 0) {
+            id = t->launchAsync(num_elements, [in, out](int i, int n) {
+                out[i] = (i % 2 == 0) ? in[i] + 2 : i;
+            }, deps, out_of_range);
+        } else {
+            id = t->launchAsync(num_elements, [in, out](int i, int n) {
+                out[i] = (in[i] * 3 + 1) % 10007;
+            }, deps, (s % 7 == 0) ? unmapped : elementwise);
+        }
+        deps = std::vector<TaskID>(1, id);
+    }
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    std::vector<int> expected(arrays[0], arrays[0] + num_elements);
+    std::vector<int> next(num_elements);
+    for (int s = 1; s <= num_stages; s++) {
+        for (int i = 0; i < num_elements; i++) {
+            if (s % 5 == 0) {
+                next[i] = expected[num_elements - 1 - i] + 1;
+            } else if (s % 11 == 0) {
+                next[i] = (i % 2 == 0) ? expected[i] + 2 : i;
+            } else {
+                next[i] = (expected[i] * 3 + 1) % 10007;
+            }
+        }
+        expected.swap(next);
+    }
+
+    TestResults results;
+    results.passed = true;
+    for (int i = 0; i < num_elements; i++) {
+        if (arrays[num_stages][i] != expected[i]) {
+            results.passed = false;
+            printf("%d: %d expected=%d\n", i, arrays[num_stages][i], expected[i]);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+
+    for (int s = 0; s <= num_stages; s++) {
+        delete [] arrays[s];
+    }
+    return results;
+}
+
+/*
+ * Computation: a long chain of small launches where every launch also
+ * names launches that have long finished: one from before a sync() and
+ * one from a thousand launches earlier, whose table slot has most likely
+ * been reused by then. Such dependencies must be recognized as satisfied,
+ * not waited for or looked up as something else. An unrelated launch is
+ * held open throughout, so that the table cannot simply start over.
+ */
+TestResults finishedDepsAsyncTest(ITaskSystem* t) {
+    int num_launches = 20000;
+    int num_tasks = 4;
+    int distance = 1000;
+
+    std::atomic<int> tasks_run(0);
+    auto count = [&tasks_run](int i, int num_total_tasks) {
+        tasks_run++;
+    };
+    // the held launch takes a worker for good, and engines without
+    // workers run launches inline, so only hold it with workers to spare
+    std::atomic<bool> open(t->numWorkers() < 2);
+    auto held = [&open](int i, int num_total_tasks) {
+        while (!open.load()) {
+            std::this_thread::yield();
+        }
+    };
+
+    double start_time = CycleTimer::currentSeconds();
+    TaskID before_sync = t->launchAsync(num_tasks, count);
+    t->sync();
+    t->launchAsync(1, held);
+    std::vector<TaskID> ids;
+    for (int j = 0; j < num_launches; j++) {
+        std::vector<TaskID> deps(1, before_sync);
+        if (j >= distance) deps.push_back(ids[j - distance]);
+        if (j >= 1) deps.push_back(ids[j - 1]);
+        ids.push_back(t->launchAsync(num_tasks, count, deps));
+    }
+    t->wait(ids.back());
+    open.store(true);
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults results;
+    results.passed = true;
+    int expected = (num_launches + 1) * num_tasks;
+    if (tasks_run.load() != expected) {
+        results.passed = false;
+        printf("%d tasks ran, expected %d\n", tasks_run.load(), expected);
+    }
+    results.time = end_time - start_time;
+    return results;
+}
+
+/*
+ * Computation: one launch that is held open while two hundred thousand
+ * short launches run to completion beside it, in chains of a thousand.
+ * Bookkeeping for finished launches must not pile up behind the held
+ * one: checks that the process's peak memory grows by less than 32 MB,
+ * and that every task ran once. The launch is only held with at least
+ * two workers, since it keeps one of them busy.
+ */
+TestResults heldLaunchAsyncTest(ITaskSystem* t) {
+    int num_chains = 200;
+    int chain_length = 1000;
+    long max_growth_kb = 32 * 1024;
+
+    std::atomic<bool> open(t->numWorkers() < 2);
+    std::atomic<int> tasks_run(0);
+    auto held = [&open, &tasks_run](int i, int num_total_tasks) {
+        while (!open.load()) {
+            std::this_thread::yield();
+        }
+        tasks_run++;
+    };
+    auto count = [&tasks_run](int i, int num_total_tasks) {
+        tasks_run++;
+    };
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long peak_before_kb = usage.ru_maxrss;
+
+    double start_time = CycleTimer::currentSeconds();
+    t->launchAsync(1, held);
+    for (int c = 0; c < num_chains; c++) {
+        std::vector<TaskID> deps;
+        for (int j = 0; j < chain_length; j++) {
+            deps = std::vector<TaskID>(1, t->launchAsync(1, count, deps));
+        }
+        t->wait(deps[0]);
+    }
+    getrusage(RUSAGE_SELF, &usage);
+    long growth_kb = usage.ru_maxrss - peak_before_kb;
+    open.store(true);
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults results;
+    results.passed = true;
+    int expected = num_chains * chain_length + 1;
+    if (tasks_run.load() != expected) {
+        results.passed = false;
+        printf("%d tasks ran, expected %d\n", tasks_run.load(), expected);
+    }
+    if (growth_kb >= max_growth_kb) {
+        results.passed = false;
+        printf("peak memory grew by %ld KB beside a held launch, expected less than %ld KB\n",
+               growth_kb, max_growth_kb);
+    }
+    results.time = end_time - start_time;
+    return results;
+}
+
+/*
+ * Computation: two TaskStreams on the same task system, each running a
+ * chain of increments over its own array; the second stream's chain is
+ * held up by a slow launch. Syncs the first stream and checks its array,
+ * then adds a launch to the first stream that depends on the end of the
+ * second stream's chain and sums its array, syncs the first stream again
+ * and checks the sum, and finally syncs the second stream. The sum is
+ * read by a completion callback, which that sync() must wait for, and
+ * both arrays are checked once more with parallelReduce() on a stream.
+ */
+TestResults streamSyncAsyncTest(ITaskSystem* t) {
+    int chain_length = 20;
+    int num_elements = 4096;
+
+    std::vector<int> a(num_elements, 0);
+    std::vector<int> b(num_elements, 0);
+    long b_sum = -1;
+    int* a_data = &a[0];
+    int* b_data = &b[0];
+
+    double start_time = CycleTimer::currentSeconds();
+    TaskStream stream_a(t);
+    TaskStream stream_b(t);
+    std::vector<TaskID> a_deps;
+    std::vector<TaskID> b_deps(1, stream_b.launchAsync(1, [](int i, int num_total_tasks) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }));
+    for (int j = 0; j < chain_length; j++) {
+        a_deps = std::vector<TaskID>(1, stream_a.launchAsync(num_elements, [a_data](int i, int n) {
+            a_data[i]++;
+        }, a_deps));
+        b_deps = std::vector<TaskID>(1, stream_b.launchAsync(num_elements, [b_data](int i, int n) {
+            b_data[i]++;
+        }, b_deps));
+    }
+
+    TestResults results;
+    results.passed = true;
+    stream_a.sync();
+    for (int i = 0; i < num_elements; i++) {
+        if (a[i] != chain_length) {
+            results.passed = false;
+            printf("a[%d] = %d after stream sync, expected %d\n", i, a[i], chain_length);
+            break;
+        }
+    }
+
+    long computed_sum = -1;
+    TaskID sum_id = stream_a.launchAsync(1, [b_data, num_elements, &computed_sum](int i, int n) {
+        long sum = 0;
+        for (int k = 0; k < num_elements; k++) sum += b_data[k];
+        computed_sum = sum;
+    }, b_deps);
+    stream_a.onComplete(sum_id, [&b_sum, &computed_sum] {
+        b_sum = computed_sum;
+    });
+    stream_a.sync();
+    if (b_sum != (long)chain_length * num_elements) {
+        results.passed = false;
+        printf("sum over the other stream = %ld, expected %ld\n",
+               b_sum, (long)chain_length * num_elements);
+    }
+    stream_b.sync();
+
+    long total = stream_b.parallelReduce(num_elements, 0L,
+        [a_data, b_data](int i, int n) { return (long)a_data[i] + b_data[i]; },
+        [](long x, long y) { return x + y; });
+    if (total != 2L * chain_length * num_elements) {
+        results.passed = false;
+        printf("parallelReduce() on a stream = %ld, expected %ld\n",
+               total, 2L * chain_length * num_elements);
+    }
+    double end_time = CycleTimer::currentSeconds();
+    results.time = end_time - start_time;
+    return results;
+}
+
+/*
+ * Computation: adds a pool for blocking tasks and runs launches of
+ * sleeping tasks on it next to compute launches on the default workers,
+ * with dependencies in both directions between the pools. The first
+ * blocking launch is held on a gate: if the engine has separate pools,
+ * the compute launch next to it must finish while the gate is closed.
+ * Each launch behind one on the other pool must see all of its writes.
+ * Checks that every task ran once. Engines without separate pools run
+ * everything on their own workers, with the gate open.
+ */
+TestResults blockingPoolAsyncTest(ITaskSystem* t) {
+    int num_blocking = 16;
+    int num_compute = 4096;
+    int stride = num_compute / num_blocking;
+
+    TestResults results;
+    results.passed = true;
+    int pool = t->addPool("blocking", num_blocking);
+    if (t->findPool("blocking") != pool) {
+        results.passed = false;
+        printf("findPool() returned %d, addPool() %d\n", t->findPool("blocking"), pool);
+    }
+    LaunchOptions blocking;
+    blocking.pool = pool;
+    bool separate = pool != 0 && t->numWorkers() > 0;
+
+    std::atomic<bool> open(!separate);
+    std::atomic<int> blocked(0);
+    std::atomic<int> computed(0);
+    std::vector<int> io_data(num_blocking, 0);
+    std::vector<int> work_data(num_compute, 0);
+    std::vector<int> io_seen(num_compute, -1);
+    std::vector<int> work_seen(num_blocking, -1);
+    auto block = [&](int i, int num_total_tasks) {
+        while (!open.load()) {
+            std::this_thread::yield();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        io_data[i] = i + 1;
+        blocked++;
+    };
+    auto compute = [&](int i, int num_total_tasks) {
+        work_data[i] = 2 * i;
+        computed++;
+    };
+    auto compute_after_io = [&](int i, int num_total_tasks) {
+        io_seen[i] = io_data[i / stride];
+        computed++;
+    };
+    auto block_after_work = [&](int i, int num_total_tasks) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        work_seen[i] = work_data[i * stride];
+        blocked++;
+    };
+
+    double start_time = CycleTimer::currentSeconds();
+    TaskID io = t->launchAsync(num_blocking, block, std::vector<TaskID>(), blocking);
+    TaskID work = t->launchAsync(num_compute, compute);
+    t->launchAsync(num_compute, compute_after_io, std::vector<TaskID>(1, io));
+    t->launchAsync(num_blocking, block_after_work, std::vector<TaskID>(1, work), blocking);
+    if (separate) {
+        // poll rather than wait(), to fail instead of hanging
+        double give_up = CycleTimer::currentSeconds() + 10.0;
+        while (!t->isDone(work) && CycleTimer::currentSeconds() < give_up) {
+            std::this_thread::yield();
+        }
+        if (!t->isDone(work)) {
+            results.passed = false;
+            printf("compute launch did not finish while the blocking pool was held\n");
+        }
+        open.store(true);
+    }
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    if (blocked.load() != 2 * num_blocking || computed.load() != 2 * num_compute) {
+        results.passed = false;
+        printf("%d blocking and %d compute tasks ran, expected %d and %d\n",
+               blocked.load(), computed.load(), 2 * num_blocking, 2 * num_compute);
+    }
+    for (int i = 0; i < num_compute; i++) {
+        if (io_seen[i] != i / stride + 1) {
+            results.passed = false;
+            printf("compute task %d saw %d from the blocking pool, expected %d\n",
+                   i, io_seen[i], i / stride + 1);
+            break;
+        }
+    }
+    for (int i = 0; i < num_blocking; i++) {
+        if (work_seen[i] != 2 * i * stride) {
+            results.passed = false;
+            printf("blocking task %d saw %d from the compute launch, expected %d\n",
+                   i, work_seen[i], 2 * i * stride);
+            break;
+        }
+    }
+    results.time = end_time - start_time;
+    return results;
+}
+
+/*
+ * Computation: under SCHEDULE_EARLIEST_DEADLINE, one launch of sleeping
+ * tasks whose deadline is far too tight next to many compute launches
+ * with loose deadlines, some of them behind it. Checks that every task
+ * ran once and that exactly the tight launch was counted as a miss, for
+ * engines that track deadlines. For engines that support the policy,
+ * then holds all workers but one and checks that launches queued behind
+ * them run earliest deadline first, and launches without one last.
+ */
+TestResults deadlineMissAsyncTest(ITaskSystem* t) {
+    int num_compute = 64;
+    int compute_width = 256;
+
+    std::atomic<int> slept(0);
+    std::atomic<int> computed(0);
+    auto sleep = [&slept](int i, int num_total_tasks) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        slept++;
+    };
+    auto compute = [&computed](int i, int num_total_tasks) {
+        computed++;
+    };
+
+    t->setSchedulingPolicy(SCHEDULE_EARLIEST_DEADLINE);
+    LaunchOptions tight;
+    tight.deadline_ns = 1000;
+    LaunchOptions loose;
+    loose.deadline_ns = 10000000000L;
+
+    double start_time = CycleTimer::currentSeconds();
+    TaskID late = t->launchAsync(2, sleep, std::vector<TaskID>(), tight);
+    for (int j = 0; j < num_compute; j++) {
+        std::vector<TaskID> deps;
+        if (j % 4 == 0) deps.push_back(late);
+        loose.deadline_ns -= 1000000;
+        t->launchAsync(compute_width, compute, deps, loose);
+    }
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults results;
+    results.passed = true;
+    if (slept.load() != 2 || computed.load() != num_compute * compute_width) {
+        results.passed = false;
+        printf("%d sleeping and %d compute tasks ran, expected %d and %d\n",
+               slept.load(), computed.load(), 2, num_compute * compute_width);
+    }
+    long misses = t->deadlineMisses();
+    if (misses != -1 && misses != 1) {
+        results.passed = false;
+        printf("deadlineMisses() = %ld, expected 1\n", misses);
+    }
+    results.time = end_time - start_time;
+
+    if (!t->setSchedulingPolicy(SCHEDULE_EARLIEST_DEADLINE) || t->numWorkers() == 0) {
+        return results;
+    }
+    int num_undated = 8;
+    int num_dated = 32;
+    std::atomic<int> next_slot(0);
+    std::vector<int> slot(num_undated + num_dated, -1);
+    WorkerGate gate;
+    gate.hold(t);
+    // submitted in the opposite order of their deadlines, after the
+    // launches without one
+    for (int j = 0; j < num_undated + num_dated; j++) {
+        LaunchOptions options;
+        if (j >= num_undated) {
+            options.deadline_ns = 1000000000L + (num_undated + num_dated - j) * 10000000L;
+        }
+        int* out = &slot[j];
+        t->launchAsync(1, [out, &next_slot](int i, int n) {
+            *out = next_slot++;
+        }, std::vector<TaskID>(), options);
+    }
+    gate.release(1);
+    while (next_slot.load() < num_undated + num_dated) {
+        std::this_thread::yield();
+    }
+    gate.release(t->numWorkers());
+    t->sync();
+    for (int j = num_undated; j < num_undated + num_dated; j++) {
+        int expected = num_undated + num_dated - 1 - j;
+        if (slot[j] != expected) {
+            results.passed = false;
+            printf("launch with the %dth earliest deadline ran %dth\n", expected, slot[j]);
+            break;
+        }
+    }
+    for (int j = 0; j < num_undated; j++) {
+        if (slot[j] < num_dated) {
+            results.passed = false;
+            printf("launch without a deadline ran %dth, before some with one\n", slot[j]);
+            break;
+        }
+    }
+    return results;
+}
+
+/*
+ * Computation: an elastic pool of Pool with 2 to 8 workers, next to the
+ * task system under test. Submits blocking tasks one at a time, faster
+ * than the busy workers finish them, and checks that the pool grew past
+ * its minimum but not past its maximum. Then lets the pool idle and
+ * checks that it shrinks back to its minimum, and checks the results of
+ * a compute launch before and after. Only runs for the engine of type
+ * Pool, and only if Pool can be constructed elastic. `t` itself is not
+ * used beyond picking that engine: its worker count is fixed when it is
+ * constructed, so the test builds an elastic Pool of its own.
+ */
+template <typename Pool>
+TestResults elasticPoolAsyncTest(ITaskSystem* t, std::true_type elastic) {
+    int min_threads = 2;
+    int max_threads = 8;
+    int num_blocking = 32;
+    int num_elements = 4096;
+
+    TestResults results;
+    results.passed = true;
+    results.time = 0;
+    // t only selects the engine; everything below runs on its own pool
+    if (dynamic_cast<Pool*>(t) == NULL) return results;
+
+    std::vector<int> out(num_elements);
+    int* out_data = &out[0];
+    auto square = [out_data](int i, int num_total_tasks) {
+        out_data[i] = i * i;
+    };
+    auto check = [&out, &results, num_elements](const char* when) {
+        for (int i = 0; i < num_elements; i++) {
+            if (out[i] != i * i) {
+                results.passed = false;
+                printf("%s: %d: %d expected=%d\n", when, i, out[i], i * i);
+                break;
+            }
+        }
+        std::fill(out.begin(), out.end(), 0);
+    };
+
+    double start_time = CycleTimer::currentSeconds();
+    Pool pool(min_threads, max_threads);
+    pool.launchAsync(num_elements, square);
+    pool.sync();
+    check("before growing");
+
+    std::atomic<int> blocked(0);
+    auto block = [&blocked](int i, int num_total_tasks) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        blocked++;
+    };
+    int peak = pool.numLiveWorkers();
+    for (int j = 0; j < num_blocking; j++) {
+        pool.launchAsync(1, block);
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        peak = std::max(peak, pool.numLiveWorkers());
+    }
+    pool.sync();
+    if (blocked.load() != num_blocking) {
+        results.passed = false;
+        printf("%d blocking tasks ran, expected %d\n", blocked.load(), num_blocking);
+    }
+    if (peak <= min_threads || peak > max_threads) {
+        results.passed = false;
+        printf("pool peaked at %d workers, expected more than %d and at most %d\n",
+               peak, min_threads, max_threads);
+    }
+
+    double give_up = CycleTimer::currentSeconds() + 5.0;
+    while (pool.numLiveWorkers() > min_threads && CycleTimer::currentSeconds() < give_up) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (pool.numLiveWorkers() != min_threads) {
+        results.passed = false;
+        printf("%d workers left after idling, expected %d\n", pool.numLiveWorkers(), min_threads);
+    }
+    pool.launchAsync(num_elements, square);
+    pool.sync();
+    check("after shrinking");
+    double end_time = CycleTimer::currentSeconds();
+
+    results.time = end_time - start_time;
+    return results;
+}
+
+template <typename Pool>
+TestResults elasticPoolAsyncTest(ITaskSystem* t, std::false_type elastic) {
+    TestResults results;
+    results.passed = true;
+    results.time = 0;
+    return results;
+}
+
+template <typename Pool>
+TestResults elasticPoolAsyncTest(ITaskSystem* t) {
+    return elasticPoolAsyncTest<Pool>(t, std::is_constructible<Pool, int, int>());
+}
+
+/*
+ * Computation: sums a large array with ITaskSystem::parallelReduce(),
+ * repeatedly, and compares against a serial sum. The sum is integral, so
+ * any lost or double-counted partial shows up as a mismatch. Also checks
+ * that an empty reduction returns the identity.
+ */
+TestResults parallelReduceTest(ITaskSystem* t) {
+    int num_elements = 1 << 20;
+    int num_reductions = 50;
+
+    int* array = new int[num_elements];
+    long expected = 0;
+    for (int i = 0; i < num_elements; i++) {
+        array[i] = (int)((i * 7919L) % 1000);
+        expected += array[i];
+    }
+
+    auto body = [array](int i, int num_total_tasks) {
+        return (long)array[i];
+    };
+    auto combine = [](long x, long y) {
+        return x + y;
+    };
+
+    TestResults results;
+    results.passed = true;
+
+    double start_time = CycleTimer::currentSeconds();
+    for (int j = 0; j < num_reductions; j++) {
+        long sum = t->parallelReduce(num_elements, 0L, body, combine);
+        if (sum != expected) {
+            results.passed = false;
+            printf("reduction %d: %ld expected=%ld\n", j, sum, expected);
+            break;
+        }
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    long empty = t->parallelReduce(0, 42L, body, combine);
+    if (empty != 42) {
+        results.passed = false;
+        printf("empty reduction: %ld expected=42\n", empty);
+    }
+    results.time = end_time - start_time;
+
+    delete [] array;
+    return results;
+}
+
 /*
  * Computation: Simple correctness test for runAsyncWithDeps.
  * Tasks sleep for a prescribed amount of time and then print